@@ -0,0 +1,12 @@
+// BenchMain.cpp : Defines the entry point of the videoslam_bench program, see CMakeLists.txt.
+
+#include "stdafx.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    // "videoslam_bench [results.csv] [filter]" runs the same benchmarks as "VideoSLAM bench"
+    int benchmarked = runBenchmarks(argc > 1 ? argv[1] : BENCHMARK_RESULTS_PATH, argc > 2 ? argv[2] : "");
+    flushLog();
+    return benchmarked;
+}
@@ -0,0 +1,306 @@
+#include "stdafx.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+using namespace cv;
+
+volatile double benchmark_sink = 0;
+
+// camera of the generated calibration views
+static const Matx33d BENCHMARK_CAMERA(800, 0, 640,
+                                      0, 800, 360,
+                                      0, 0, 1);
+static const Size BENCHMARK_GRID_SIZE(7, 5);        // as the calibration pattern
+static const float BENCHMARK_GRID_SPACING = 0.015f;
+static const int BENCHMARK_WARMUP_FRAMES = 10;      // the frame buffers of the tracker reach their size in these
+static const int BENCHMARK_CHECKED_FRAMES = 100;    // must not allocate after the warm-up
+
+
+Benchmark::Benchmark() {
+    this->repetitions = 5;
+    this->min_repetition_ns = 20000000;
+}
+
+Benchmark::~Benchmark() = default;
+
+bool Benchmark::enabled(const string& name) const {
+    return filter.empty() || name.find(filter) != string::npos;
+}
+
+void Benchmark::addResult(const string& name, int size, long long iterations, vector<double>& times) {
+    sort(times.begin(), times.end());
+
+    BenchmarkResult result;
+    result.name = name;
+    result.size = size;
+    result.iterations = iterations;
+    result.repetitions = (int) times.size();
+    if(!times.empty()) {
+        result.ns_per_op = times[times.size() / 2];
+        result.min_ns = times.front();
+        result.max_ns = times.back();
+    }
+    results.push_back(result);
+    LOG(Info, Main, "{} ({}): {} ns per call, {} iterations", name, size, result.ns_per_op, iterations);
+}
+
+/// <sumary>
+/// Writes one line per result. Times are in nanoseconds per call of the benchmarked operation.
+/// </sumary>
+bool Benchmark::writeCsv(string fileName) const {
+    ofstream outStream(fileName);
+    if(!outStream) return false;
+
+    outStream << "benchmark,size,iterations,repetitions,ns_per_op,min_ns,max_ns\n";
+    outStream << fixed << setprecision(1);
+    for(size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        outStream << r.name << "," << r.size << "," << r.iterations << "," << r.repetitions << ","
+                  << r.ns_per_op << "," << r.min_ns << "," << r.max_ns << "\n";
+    }
+    return (bool) outStream;
+}
+
+
+/// <sumary>
+/// Generates detections of markers in front of the camera, as aruco::estimatePoseSingleMarkers returns them.
+/// </sumary>
+void generateMarkerPoses(int num_markers, uint64_t seed, vector<Vec3d>& rvecs, vector<Vec3d>& tvecs) {
+    RNG rng(seed);
+    rvecs.resize(num_markers);
+    tvecs.resize(num_markers);
+    for(int i = 0; i < num_markers; i++) {
+        Vec3d axis(rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0));
+        rvecs[i] = axis * (rng.uniform(0.1, CV_PI) / max(norm(axis), 1e-6));
+        tvecs[i] = Vec3d(rng.uniform(-1.0, 1.0), rng.uniform(-0.6, 0.6), rng.uniform(0.3, 5.0));
+    }
+}
+
+/// <sumary>
+/// Generates grid detections of a calibration, the grid is seen from random poses in front of the camera.
+/// </sumary>
+/// <param name="views">Projected grid points of every view, with pixel noise</param>
+void generateCalibrationViews(int num_views, Size grid_size, float spacing, uint64_t seed, vector<vector<Point2f>>& views) {
+    RNG rng(seed);
+    vector<Point3f> grid;
+    for(int i = 0; i < grid_size.height; i++) {
+        for(int j = 0; j < grid_size.width; j++) {
+            grid.push_back(Point3f(j * spacing, i * spacing, 0));
+        }
+    }
+    Vec<double, 5> distortion(-0.1, 0.01, 0, 0, 0);
+
+    views.resize(num_views);
+    for(int v = 0; v < num_views; v++) {
+        Vec3d rvec(rng.uniform(-0.5, 0.5), rng.uniform(-0.5, 0.5), rng.uniform(-0.3, 0.3));
+        Vec3d tvec(rng.uniform(-0.1, 0.05), rng.uniform(-0.06, 0.03), rng.uniform(0.2, 0.4));
+        projectPoints(grid, rvec, tvec, BENCHMARK_CAMERA, distortion, views[v]);
+        for(size_t p = 0; p < views[v].size(); p++) {
+            views[v][p] += Point2f((float) rng.gaussian(0.1), (float) rng.gaussian(0.1));
+        }
+    }
+}
+
+/// <sumary>
+/// Writes a sensor data file in the format of the recording app, with alternating accelerometer and gyroscope
+/// samples at 200 Hz.
+/// </sumary>
+/// <param name="num_samples">Number of accelerometer and gyroscope sample pairs</param>
+bool generateSensorData(string fileName, int num_samples, uint64_t seed) {
+    ofstream outStream(fileName);
+    if(!outStream) return false;
+
+    RNG rng(seed);
+    long long time = 1623142800000000000LL;
+    long long period = 5000000;
+    outStream << "VIDEO_START " << time << "\n";
+    outStream << fixed << setprecision(6);
+    for(int i = 0; i < num_samples; i++) {
+        time += period;
+        outStream << "A " << time << " " << time - 1000 << " " << rng.gaussian(0.2) << " " << 9.81 + rng.gaussian(0.2) << " " << rng.gaussian(0.2) << "\n";
+        outStream << "G " << time + 100000 << " " << time + 99000 << " " << rng.gaussian(0.05) << " " << rng.gaussian(0.05) << " " << rng.gaussian(0.05) << "\n";
+    }
+    outStream << "VIDEO_STOP " << time + period << "\n";
+    return (bool) outStream;
+}
+
+
+/// <sumary>
+/// Generates a grayscale frame of the camera with markers of the dictionary on a white background, in rows of four.
+/// </sumary>
+/// <param name="num_markers">Number of markers, up to 12</param>
+Mat generateMarkerFrame(int num_markers) {
+    Mat frame(720, 1280, CV_8UC1, Scalar(255));
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(DICTIONARY_NAME);
+    for(int i = 0; i < num_markers && i < 12; i++) {
+        Mat marker;
+        aruco::drawMarker(dictionary, i, 120, marker);
+        marker.copyTo(frame(Rect(130 + 280 * (i % 4), 90 + 200 * (i / 4), 120, 120)));
+    }
+    return frame;
+}
+
+
+/// <sumary>
+/// Benchmarks the per frame pose computations of the tracker, for frames with different numbers of detected markers.
+/// Every call handles all markers of a frame.
+/// </sumary>
+void benchmarkPose(Benchmark& benchmark, const vector<int>& marker_counts) {
+    for(size_t c = 0; c < marker_counts.size(); c++) {
+        int num_markers = marker_counts[c];
+        vector<Vec3d> rvecs, tvecs;
+        generateMarkerPoses(num_markers + 1, 42 + num_markers, rvecs, tvecs);
+
+        vector<MarkerObservation> observations(num_markers + 1);
+        benchmark.run("getCameraPoseBasedOnMarker", num_markers, [&]() {
+            for(int i = 0; i < num_markers; i++) Tracker::getCameraPoseBasedOnMarker(observations[i], rvecs[i], tvecs[i]);
+            benchmark_sink = observations[0].camera_position[0];
+        });
+        for(int i = 0; i <= num_markers; i++) {
+            observations[i].marker_id = i;
+            Tracker::getCameraPoseBasedOnMarker(observations[i], rvecs[i], tvecs[i]);
+        }
+
+        benchmark.run("closestMarker", num_markers, [&]() {
+            benchmark_sink = Tracker::closestMarker(observations.data(), num_markers);
+        });
+
+        // every marker is mapped through the same mapped marker, the last one generated
+        MarkerInfo previous = Tracker::toMarkerInfo(observations[num_markers]);
+        previous.world_position = Vec3d(0.5, 0, 0);
+        previous.world_orientation_matrix = Mat(rotationExp(Vec3d(0, 0, 0.3)));
+        vector<MarkerInfo> current(num_markers);
+        for(int i = 0; i < num_markers; i++) current[i] = Tracker::toMarkerInfo(observations[i]);
+
+        benchmark.run("computeTransforms", num_markers, [&]() {
+            for(int i = 0; i < num_markers; i++) Tracker::computeTransforms(current[i], previous);
+            benchmark_sink = current[0].world_position[0];
+        });
+    }
+}
+
+/// <sumary>
+/// Benchmarks reading the calibration file, for every distortion model, and the calibration for different numbers of views.
+/// </sumary>
+/// <param name="directory">Directory for the generated calibration files</param>
+void benchmarkCalibration(Benchmark& benchmark, string directory, const vector<int>& view_counts) {
+    const int models[] = {4, 5, 8, 12, 14};
+    for(int m = 0; m < 5; m++) {
+        int num_coefficients = models[m];
+        CalibrationData calibration;
+        calibration.cameraMatrix = Mat(BENCHMARK_CAMERA);
+        calibration.distortionCoefficients = Mat::zeros(num_coefficients, 1, CV_64F);
+        calibration.distortionCoefficients.at<double>(0, 0) = -0.1;
+        calibration.imageSize = Size(1280, 720);
+        calibration.rms = 0.2;
+
+        string fileName = directory + "calibration_" + to_string(num_coefficients) + ".bin";
+        if(!CamCalib::writeCalibrationData(fileName, calibration)) {
+            LOG(Warning, Main, "Could not write the calibration file {}", fileName);
+            continue;
+        }
+        benchmark.run("readCalibrationData", num_coefficients, [&]() {
+            CalibrationData data;
+            CamCalib::readCalibrationData(fileName, data);
+            benchmark_sink = data.rms;
+        });
+    }
+
+    for(size_t c = 0; c < view_counts.size(); c++) {
+        vector<vector<Point2f>> views;
+        generateCalibrationViews(view_counts[c], BENCHMARK_GRID_SIZE, BENCHMARK_GRID_SPACING, 7 + view_counts[c], views);
+        benchmark.run("calibrateAndReproject", view_counts[c], [&]() {
+            Mat cameraMatrix, distortionCoefficients;
+            benchmark_sink = calibrateAndReproject(views, BENCHMARK_GRID_SIZE, BENCHMARK_GRID_SPACING, cameraMatrix, distortionCoefficients);
+        });
+    }
+}
+
+/// <sumary>
+/// Benchmarks the tracker's processing of a whole frame, the detection with FastArucoDetector and the map update,
+/// for frames with different numbers of markers. Once the tracker is warmed up on a frame, processing the same frame
+/// again must not allocate. Allocations inside of OpenCV are not counted, they are out of the tracker's control.
+/// </sumary>
+/// <returns>False if a warmed up frame allocated, only checked when the allocations are counted</returns>
+bool benchmarkFrameLoop(Benchmark& benchmark, const vector<int>& marker_counts) {
+    if(!benchmark.enabled("processFrame")) return true;
+
+    bool allocation_free = true;
+    for(size_t c = 0; c < marker_counts.size(); c++) {
+        int num_markers = marker_counts[c];
+        Mat frame = generateMarkerFrame(num_markers);
+        Tracker tracker(Mat(BENCHMARK_CAMERA), Mat::zeros(5, 1, CV_64F), 0.05f, num_markers);
+        for(int i = 0; i < BENCHMARK_WARMUP_FRAMES; i++) tracker.processFrame(frame, i / 30.0);
+
+#ifdef COUNT_ALLOCATIONS
+        uint64_t allocations = 0;
+        for(int i = 0; i < BENCHMARK_CHECKED_FRAMES; i++) {
+            tracker.processFrame(frame, i / 30.0);
+            allocations += tracker.getLastAllocations();
+        }
+        if(allocations > 0) {
+            LOG(Error, Main, "processFrame ({}): {} allocations in {} frames after the warm-up", num_markers, allocations, BENCHMARK_CHECKED_FRAMES);
+            allocation_free = false;
+        }
+#endif
+
+        benchmark.run("processFrame", num_markers, [&]() {
+            benchmark_sink = tracker.processFrame(frame, 0).position[0];
+        });
+    }
+    return allocation_free;
+}
+
+
+/// <sumary>
+/// Times the hot functions of the pose computation, the calibration, the sensor data rewrite and the frame loop on generated
+/// inputs of different sizes, and writes the results as CSV, one line per function and input size. When the allocations
+/// are counted, as in debug builds and the videoslam_bench program, the run fails if the warmed up frame loop allocates.
+/// </sumary>
+/// <param name="results_file">CSV file, to which the results are written</param>
+/// <param name="filter">Only the benchmarks whose name contains it are run, empty to run all</param>
+/// <returns>0 on success, error code of the program otherwise</returns>
+int runBenchmarks(string results_file, string filter) {
+    string directory = (experimental::filesystem::temp_directory_path() / "VideoSLAM_benchmark").string() + "/";
+    experimental::filesystem::create_directories(directory);
+
+    Benchmark benchmark;
+    benchmark.filter = filter;
+    benchmarkPose(benchmark, {1, 4, 16, 64});
+    benchmarkCalibration(benchmark, directory, {5, 10, 25});
+    bool allocation_free = benchmarkFrameLoop(benchmark, {1, 4, 12});
+
+    // the rewrite reads and writes files, every call goes through the whole file
+    int sample_counts[] = {1000, 10000, 100000};
+    for(int c = 0; c < 3 && benchmark.enabled("rewriteIMUfile"); c++) {
+        string sensor_file = directory + "sensor_data_" + to_string(sample_counts[c]) + ".txt";
+        string output_file = directory + "imu_data_" + to_string(sample_counts[c]) + ".txt";
+        if(!generateSensorData(sensor_file, sample_counts[c], 3 + c)) {
+            LOG(Warning, Main, "Could not write the sensor data file {}", sensor_file);
+            continue;
+        }
+        benchmark.run("rewriteIMUfile", sample_counts[c], [&]() {
+            long start_sec, start_nano;
+            benchmark_sink = rewriteIMUfile(sensor_file, &start_sec, &start_nano, output_file);
+        });
+    }
+
+    error_code removed;
+    experimental::filesystem::remove_all(directory, removed);
+
+    experimental::filesystem::path parent = experimental::filesystem::path(results_file).parent_path();
+    if(!parent.empty()) experimental::filesystem::create_directories(parent);
+    if(!benchmark.writeCsv(results_file)) {
+        LOG(Error, Main, "Could not write the benchmark results {}", results_file);
+        return -9;
+    }
+    LOG(Info, Main, "Wrote {} benchmark results to {}", benchmark.getResults().size(), results_file);
+
+    // the frame loop has to run without allocating once it is warmed up
+    if(!allocation_free) return -9;
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Metrics.h"
+
+static const long long BENCHMARK_MAX_ITERATIONS = 100000000;    // per repetition, for operations too fast for the clock
+static const char BENCHMARK_RESULTS_PATH[] = "Results/Benchmark.csv";
+
+
+// timing of one benchmark on one generated input
+struct BenchmarkResult {
+    std::string name;
+    int size = 0;                       // markers, views, distortion coefficients or sensor samples of the input
+    long long iterations = 0;           // per repetition
+    int repetitions = 0;
+    double ns_per_op = 0;               // median of the repetitions
+    double min_ns = 0;
+    double max_ns = 0;
+};
+
+// results of the benchmarked functions are written here, so the compiler cannot remove the calls
+extern volatile double benchmark_sink;
+
+/// <sumary>
+/// Times small functions on generated inputs, so regressions of a single function show without a full run.
+/// A benchmark is run in repetitions of as many iterations as fit into min_repetition_ns, which hides the clock
+/// resolution, and the median time per iteration of the repetitions is reported. Results are written as CSV,
+/// so runs of different commits can be compared.
+/// </sumary>
+class Benchmark {
+public:
+    // attributes
+    int repetitions;                    // timed repetitions of every benchmark, after a warm up
+    uint64_t min_repetition_ns;         // iterations are added until a repetition lasts this long
+    std::string filter;                 // only benchmarks whose name contains it are run, empty to run all
+
+    // constructors & deconstructors
+    Benchmark();
+    virtual ~Benchmark();
+
+    // methods
+    bool enabled(const std::string& name) const;
+    const std::vector<BenchmarkResult>& getResults() const { return results; }
+    bool writeCsv(std::string fileName) const;
+
+    /// <sumary>
+    /// Times the operation and adds its result. The operation is called once per iteration, with the same input.
+    /// </sumary>
+    template<typename Operation>
+    void run(const std::string& name, int size, Operation operation) {
+        if(!enabled(name)) return;
+
+        // warm up, and find how many iterations fill a repetition
+        long long iterations = 1;
+        while(true) {
+            uint64_t start = metricsTime();
+            for(long long i = 0; i < iterations; i++) operation();
+            uint64_t elapsed = metricsTime() - start;
+            if(elapsed >= min_repetition_ns || iterations >= BENCHMARK_MAX_ITERATIONS) break;
+
+            // aim a little past the minimum, so the next try usually fills it
+            long long estimate = elapsed == 0 ? iterations * 10 : (long long) (1.2 * iterations * min_repetition_ns / elapsed) + 1;
+            iterations = std::min(BENCHMARK_MAX_ITERATIONS, std::max(estimate, iterations + 1));
+        }
+
+        std::vector<double> times(repetitions);
+        for(int r = 0; r < repetitions; r++) {
+            uint64_t start = metricsTime();
+            for(long long i = 0; i < iterations; i++) operation();
+            times[r] = (double) (metricsTime() - start) / iterations;
+        }
+        addResult(name, size, iterations, times);
+    }
+
+private:
+    std::vector<BenchmarkResult> results;
+
+    void addResult(const std::string& name, int size, long long iterations, std::vector<double>& times);
+};
+
+// generated inputs
+void generateMarkerPoses(int num_markers, uint64_t seed, std::vector<cv::Vec3d>& rvecs, std::vector<cv::Vec3d>& tvecs);
+void generateCalibrationViews(int num_views, cv::Size grid_size, float spacing, uint64_t seed, std::vector<std::vector<cv::Point2f>>& views);
+bool generateSensorData(std::string fileName, int num_samples, uint64_t seed);
+cv::Mat generateMarkerFrame(int num_markers);
+
+// benchmarks of the functions outside of the main program
+void benchmarkPose(Benchmark& benchmark, const std::vector<int>& marker_counts);
+void benchmarkCalibration(Benchmark& benchmark, std::string directory, const std::vector<int>& view_counts);
+bool benchmarkFrameLoop(Benchmark& benchmark, const std::vector<int>& marker_counts);
+
+// all benchmarks, as run by "VideoSLAM bench" and the videoslam_bench program
+int runBenchmarks(std::string results_file, std::string filter);
+
+#endif
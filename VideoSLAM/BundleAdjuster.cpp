@@ -0,0 +1,369 @@
+#include "stdafx.h"
+#include "BundleAdjuster.h"
+
+using namespace std;
+using namespace cv;
+
+typedef Matx<double, 2, 6> Matx26d;
+
+// camera pose: X_c = G * (X_w - c), marker pose: X_w = M * X_m + p
+struct CameraParameters {
+    Matx33d G;
+    Vec3d c;
+};
+
+struct MarkerParameters {
+    Matx33d M;
+    Vec3d p;
+    int map_index;
+    bool fixed;                         // the world's origin is not moved
+};
+
+static Vec2d project(const CameraParameters& camera, const MarkerParameters& marker, const Vec3d& model_point) {
+    Vec3d point = camera.G * (marker.M * model_point + marker.p - camera.c);
+    if(point[2] < 1e-6) point[2] = 1e-6;
+    return Vec2d(point[0] / point[2], point[1] / point[2]);
+}
+
+// both poses are updated by a rotation on the left and an added translation
+static void applyUpdate(Matx33d& R, Vec3d& t, const Vec6d& delta) {
+    R = rotationExp(Vec3d(delta[0], delta[1], delta[2])) * R;
+    t += Vec3d(delta[3], delta[4], delta[5]);
+}
+
+/// <sumary>
+/// Starts the adjuster thread.
+/// </sumary>
+/// <param name="map">Marker map of the tracker, refined marker poses are written to it</param>
+/// <param name="marker_length">Length of the marker side in meters</param>
+/// <param name="window_size">Number of last frames that are adjusted</param>
+BundleAdjuster::BundleAdjuster(shared_ptr<MarkerMap> map, float marker_length, int window_size) {
+    this->max_iterations = 5;
+    this->huber_threshold = 2.0;
+    this->map = map;
+    this->marker_length = marker_length;
+    this->window_size = window_size;
+    this->has_new_frames = false;
+    this->pending_frames = 0;
+    this->solving = false;
+    this->running = true;
+    this->adjuster_thread = thread(&BundleAdjuster::run, this);
+}
+
+BundleAdjuster::~BundleAdjuster() {
+    {
+        lock_guard<mutex> lock(window_mutex);
+        running = false;
+    }
+    window_changed.notify_one();
+    adjuster_thread.join();
+}
+
+/// <sumary>
+/// Sets the function, that is called on the adjuster thread with the refined pose of every frame in the window,
+/// each time the window has been adjusted. A frame's last refined pose is final once it leaves the window.
+/// </sumary>
+void BundleAdjuster::setRefinedPoseCallback(function<void(const FramePose&)> callback) {
+    lock_guard<mutex> lock(window_mutex);
+    refined_callback = callback;
+}
+
+/// <sumary>
+/// Adds a frame with a valid pose to the window. Only copies the observations, the adjustment runs later.
+/// </sumary>
+/// <param name="pose">Pose of the frame computed by the tracker</param>
+/// <param name="marker_ids">IDs of the mapped markers seen in the frame</param>
+/// <param name="normalized_corners">Undistorted corners of the markers in normalized image coordinates</param>
+/// <param name="pixel_scale">Focal length of the camera in pixels</param>
+void BundleAdjuster::addFrame(const FramePose& pose, const vector<int>& marker_ids, const vector<vector<Point2f>>& normalized_corners, double pixel_scale) {
+    if(!pose.valid || marker_ids.empty()) return;
+
+    {
+        lock_guard<mutex> lock(window_mutex);
+        window.push_back(Frame());
+        Frame& frame = window.back();
+        frame.pose = pose;
+        frame.pixel_scale = pixel_scale;
+        frame.marker_ids = marker_ids;
+        frame.corners = normalized_corners;
+        while((int) window.size() > window_size) window.pop_front();
+        has_new_frames = true;
+        pending_frames++;
+    }
+    addMetric(Metric::BundleAdjusterQueue);
+    window_changed.notify_one();
+}
+
+/// <sumary>
+/// Waits until all added frames have been adjusted.
+/// </sumary>
+void BundleAdjuster::finish() {
+    unique_lock<mutex> lock(window_mutex);
+    window_solved.wait(lock, [this]() { return !has_new_frames && !solving; });
+}
+
+void BundleAdjuster::run() {
+    vector<Frame> frames;
+    while(true) {
+        {
+            unique_lock<mutex> lock(window_mutex);
+            window_changed.wait(lock, [this]() { return has_new_frames || !running; });
+            if(!running) break;
+
+            // the tracker keeps adding frames while the copy is adjusted
+            frames.assign(window.begin(), window.end());
+            has_new_frames = false;
+            solving = true;
+            subtractMetric(Metric::BundleAdjusterQueue, pending_frames);
+            pending_frames = 0;
+        }
+
+        if(frames.size() >= 2) solve(frames);
+
+        function<void(const FramePose&)> callback;
+        {
+            lock_guard<mutex> lock(window_mutex);
+            // the refined poses are the starting point of the next adjustment
+            for(size_t i = 0; i < window.size(); i++) {
+                for(size_t j = 0; j < frames.size(); j++) {
+                    if(frames[j].pose.frame_num == window[i].pose.frame_num) window[i].pose = frames[j].pose;
+                }
+            }
+            callback = refined_callback;
+        }
+
+        if(callback && frames.size() >= 2) {
+            for(size_t i = 0; i < frames.size(); i++) callback(frames[i].pose);
+        }
+
+        {
+            lock_guard<mutex> lock(window_mutex);
+            solving = false;
+        }
+        window_solved.notify_all();
+    }
+}
+
+void BundleAdjuster::solve(vector<Frame>& frames) {
+    int num_frames = (int) frames.size();
+
+    // markers of the window, with their current poses from the map
+    vector<int> ids;
+    for(int f = 0; f < num_frames; f++) {
+        for(size_t o = 0; o < frames[f].marker_ids.size(); o++) {
+            if(find(ids.begin(), ids.end(), frames[f].marker_ids[o]) == ids.end()) ids.push_back(frames[f].marker_ids[o]);
+        }
+    }
+    vector<MarkerPose> found(ids.size());
+    vector<int> indices(ids.size());
+    map->lookup(ids.data(), ids.size(), found.data(), indices.data());
+
+    int num_markers = (int) ids.size();
+    vector<MarkerParameters> markers(num_markers);
+    bool gauge_fixed = false;
+    for(int m = 0; m < num_markers; m++) {
+        markers[m].map_index = indices[m];
+        markers[m].fixed = indices[m] == -1 || found[m].previous_marker_index == WORLD;
+        if(indices[m] == -1) continue;
+
+        markers[m].M = found[m].world_orientation_matrix.t();
+        markers[m].p = found[m].world_position;
+        gauge_fixed = gauge_fixed || markers[m].fixed;
+    }
+
+    vector<CameraParameters> cameras(num_frames);
+    for(int f = 0; f < num_frames; f++) {
+        cameras[f].G = frames[f].pose.orientation_matrix;
+        cameras[f].c = frames[f].pose.position;
+    }
+
+    // observations of every frame, as indices into markers
+    vector<vector<int>> observed(num_frames);
+    for(int f = 0; f < num_frames; f++) {
+        for(size_t o = 0; o < frames[f].marker_ids.size(); o++) {
+            int m = (int) (find(ids.begin(), ids.end(), frames[f].marker_ids[o]) - ids.begin());
+            observed[f].push_back(indices[m] == -1 ? -1 : m);
+        }
+    }
+
+    double half = marker_length / 2;
+    const Vec3d model_points[4] = { Vec3d(-half, half, 0), Vec3d(half, half, 0), Vec3d(half, -half, 0), Vec3d(-half, -half, 0) };
+
+    // robust cost of the window, in squared pixels
+    auto computeCost = [&](const vector<CameraParameters>& cameras, const vector<MarkerParameters>& markers) {
+        double cost = 0;
+        for(int f = 0; f < num_frames; f++) {
+            for(size_t o = 0; o < observed[f].size(); o++) {
+                if(observed[f][o] == -1) continue;
+                for(int k = 0; k < 4; k++) {
+                    Vec2d r = (project(cameras[f], markers[observed[f][o]], model_points[k]) - Vec2d(frames[f].corners[o][k].x, frames[f].corners[o][k].y)) * frames[f].pixel_scale;
+                    double e = norm(r);
+                    cost += e <= huber_threshold ? e * e : 2 * huber_threshold * e - huber_threshold * huber_threshold;
+                }
+            }
+        }
+        return cost;
+    };
+
+    double cost = computeCost(cameras, markers);
+    double initial_cost = cost;
+    double lambda = 1e-3;
+    const double step = 1e-7;
+
+    for(int iteration = 0; iteration < max_iterations; iteration++) {
+        // normal equations, camera-camera and marker-marker blocks are block diagonal
+        vector<Matx66d> Hcc(num_frames, Matx66d::zeros()), Hpp(num_markers, Matx66d::zeros());
+        vector<Vec6d> gc(num_frames, Vec6d::all(0)), gp(num_markers, Vec6d::all(0));
+        vector<vector<Matx66d>> Hcp(num_frames);
+
+        for(int f = 0; f < num_frames; f++) {
+            Hcp[f].assign(observed[f].size(), Matx66d::zeros());
+            for(size_t o = 0; o < observed[f].size(); o++) {
+                int m = observed[f][o];
+                if(m == -1) continue;
+
+                for(int k = 0; k < 4; k++) {
+                    Vec2d measured(frames[f].corners[o][k].x, frames[f].corners[o][k].y);
+                    double scale = frames[f].pixel_scale;
+                    Vec2d r = (project(cameras[f], markers[m], model_points[k]) - measured) * scale;
+
+                    // numeric Jacobians of the residual by the camera and the marker update
+                    Matx26d Jc, Jp;
+                    for(int d = 0; d < 6; d++) {
+                        Vec6d delta = Vec6d::all(0);
+                        delta[d] = step;
+
+                        CameraParameters camera_plus = cameras[f], camera_minus = cameras[f];
+                        applyUpdate(camera_plus.G, camera_plus.c, delta);
+                        applyUpdate(camera_minus.G, camera_minus.c, -delta);
+                        Vec2d dc = (project(camera_plus, markers[m], model_points[k]) - project(camera_minus, markers[m], model_points[k])) * (scale / (2 * step));
+
+                        MarkerParameters marker_plus = markers[m], marker_minus = markers[m];
+                        applyUpdate(marker_plus.M, marker_plus.p, delta);
+                        applyUpdate(marker_minus.M, marker_minus.p, -delta);
+                        Vec2d dp = (project(cameras[f], marker_plus, model_points[k]) - project(cameras[f], marker_minus, model_points[k])) * (scale / (2 * step));
+
+                        for(int row = 0; row < 2; row++) {
+                            Jc(row, d) = dc[row];
+                            Jp(row, d) = markers[m].fixed ? 0 : dp[row];
+                        }
+                    }
+
+                    // Huber weight
+                    double e = norm(r);
+                    double w = e <= huber_threshold ? 1 : huber_threshold / e;
+
+                    Hcc[f] += Jc.t() * Jc * w;
+                    Hpp[m] += Jp.t() * Jp * w;
+                    Hcp[f][o] += Jc.t() * Jp * w;
+                    gc[f] -= Jc.t() * r * w;
+                    gp[m] -= Jp.t() * r * w;
+                }
+            }
+        }
+
+        // damping, fixed markers get an identity block and no update
+        for(int f = 0; f < num_frames; f++) {
+            for(int d = 0; d < 6; d++) Hcc[f](d, d) += lambda * (1 + Hcc[f](d, d));
+        }
+        vector<Matx66d> Hpp_inv(num_markers);
+        for(int m = 0; m < num_markers; m++) {
+            if(markers[m].fixed) {
+                Hpp_inv[m] = Matx66d::zeros();
+                continue;
+            }
+            for(int d = 0; d < 6; d++) Hpp[m](d, d) += lambda * (1 + Hpp[m](d, d));
+            Hpp_inv[m] = Hpp[m].inv(DECOMP_CHOLESKY);
+        }
+
+        // reduced camera system: S = Hcc - Hcp * Hpp^-1 * Hpc
+        Mat S = Mat::zeros(6 * num_frames, 6 * num_frames, CV_64F);
+        Mat rhs = Mat::zeros(6 * num_frames, 1, CV_64F);
+        for(int f = 0; f < num_frames; f++) {
+            Mat(Hcc[f]).copyTo(S(Rect(6 * f, 6 * f, 6, 6)));
+            Mat(gc[f]).copyTo(rhs.rowRange(6 * f, 6 * f + 6));
+        }
+        for(int f1 = 0; f1 < num_frames; f1++) {
+            for(size_t o1 = 0; o1 < observed[f1].size(); o1++) {
+                int m = observed[f1][o1];
+                if(m == -1 || markers[m].fixed) continue;
+
+                Matx66d HcpHinv = Hcp[f1][o1] * Hpp_inv[m];
+                Mat block = rhs.rowRange(6 * f1, 6 * f1 + 6);
+                block -= Mat(HcpHinv * gp[m]);
+
+                // frames that see the same marker are coupled
+                for(int f2 = 0; f2 < num_frames; f2++) {
+                    for(size_t o2 = 0; o2 < observed[f2].size(); o2++) {
+                        if(observed[f2][o2] != m) continue;
+                        Mat coupling = S(Rect(6 * f2, 6 * f1, 6, 6));
+                        coupling -= Mat(HcpHinv * Hcp[f2][o2].t());
+                    }
+                }
+            }
+        }
+
+        // without the origin in the window, the oldest camera is kept in place
+        if(!gauge_fixed) {
+            S.rowRange(0, 6).setTo(0);
+            S.colRange(0, 6).setTo(0);
+            setIdentity(S(Rect(0, 0, 6, 6)));
+            rhs.rowRange(0, 6).setTo(0);
+        }
+
+        Mat camera_delta;
+        if(!cv::solve(S, rhs, camera_delta, DECOMP_CHOLESKY)) {
+            lambda *= 10;
+            continue;
+        }
+
+        // back substitution of the marker updates
+        vector<Vec6d> marker_delta(num_markers, Vec6d::all(0));
+        vector<Vec6d> marker_rhs = gp;
+        for(int f = 0; f < num_frames; f++) {
+            Vec6d dc((double*) camera_delta.ptr<double>(6 * f));
+            for(size_t o = 0; o < observed[f].size(); o++) {
+                int m = observed[f][o];
+                if(m == -1 || markers[m].fixed) continue;
+                marker_rhs[m] -= Hcp[f][o].t() * dc;
+            }
+        }
+        for(int m = 0; m < num_markers; m++) {
+            marker_delta[m] = Hpp_inv[m] * marker_rhs[m];
+        }
+
+        // try the step
+        vector<CameraParameters> new_cameras = cameras;
+        vector<MarkerParameters> new_markers = markers;
+        for(int f = 0; f < num_frames; f++) {
+            applyUpdate(new_cameras[f].G, new_cameras[f].c, Vec6d((double*) camera_delta.ptr<double>(6 * f)));
+        }
+        for(int m = 0; m < num_markers; m++) {
+            if(!markers[m].fixed) applyUpdate(new_markers[m].M, new_markers[m].p, marker_delta[m]);
+        }
+
+        double new_cost = computeCost(new_cameras, new_markers);
+        if(new_cost < cost) {
+            cameras.swap(new_cameras);
+            markers.swap(new_markers);
+            lambda = max(lambda / 10, 1e-9);
+            bool converged = cost - new_cost < 1e-6 * cost;
+            cost = new_cost;
+            if(converged) break;
+        } else {
+            lambda *= 10;
+        }
+    }
+
+    if(cost >= initial_cost) return;
+
+    LOG(Debug, Slam, "Window of {} frames adjusted, cost {} -> {}", num_frames, initial_cost, cost);
+
+    for(int f = 0; f < num_frames; f++) {
+        frames[f].pose.orientation_matrix = cameras[f].G;
+        frames[f].pose.position = cameras[f].c;
+    }
+    for(int m = 0; m < num_markers; m++) {
+        if(!markers[m].fixed) map->updatePose(markers[m].map_index, markers[m].p, markers[m].M.t());
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef BUNDLE_ADJUSTER_H
+#define BUNDLE_ADJUSTER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Tracker.h"
+
+
+/// <sumary>
+/// Sliding-window bundle adjustment of the last frames of a tracker. Camera poses and the poses of the markers
+/// seen in the window are refined jointly from the marker corners, on a background thread.
+/// The marker poses are eliminated with the Schur complement, so only a system of the camera poses is solved.
+/// Refined marker poses are written to the marker map, refined camera poses are handed to the callback.
+/// </sumary>
+class BundleAdjuster {
+public:
+    // attributes
+    int max_iterations;                 // Levenberg-Marquardt iterations per window
+    double huber_threshold;             // reprojection error in pixels, above which observations are down-weighted
+
+    // constructors & deconstructors
+    BundleAdjuster(std::shared_ptr<MarkerMap> map, float marker_length, int window_size);
+    virtual ~BundleAdjuster();
+
+    // methods
+    void addFrame(const FramePose& pose, const std::vector<int>& marker_ids, const std::vector<std::vector<cv::Point2f>>& normalized_corners, double pixel_scale);
+    void setRefinedPoseCallback(std::function<void(const FramePose&)> callback);
+    void finish();
+
+private:
+    // a frame of the window
+    struct Frame {
+        FramePose pose;
+        double pixel_scale;                                 // focal length, the error is measured in pixels
+        std::vector<int> marker_ids;
+        std::vector<std::vector<cv::Point2f>> corners;      // undistorted, in normalized image coordinates
+    };
+
+    std::shared_ptr<MarkerMap> map;
+    double marker_length;
+    int window_size;
+    std::function<void(const FramePose&)> refined_callback;
+
+    std::thread adjuster_thread;
+    std::mutex window_mutex;
+    std::condition_variable window_changed, window_solved;
+    std::deque<Frame> window;
+    bool has_new_frames;
+    int pending_frames;                                     // added since the window was last copied
+    bool solving;
+    bool running;
+
+    void run();
+    void solve(std::vector<Frame>& frames);
+};
+
+#endif
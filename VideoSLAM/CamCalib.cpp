@@ -6,7 +6,7 @@ using namespace cv;
 
 
 
-void cameraCalibration(vector<vector<Point2f>> imagePoints, Size grid_size, float radius, Mat& cameraMatrix, Mat& distortionCoefficiens) {
+double cameraCalibration(vector<vector<Point2f>> imagePoints, Size image_size, Size grid_size, float radius, Mat& cameraMatrix, Mat& distortionCoefficiens) {
     vector<vector<Point3f>> worldPoints(1);
     for(int i = 0; i < grid_size.height; i++) {
         for(int j = 0; j < grid_size.width; j++) {
@@ -16,7 +16,7 @@ void cameraCalibration(vector<vector<Point2f>> imagePoints, Size grid_size, floa
     worldPoints.resize(imagePoints.size(), worldPoints[0]);
 
     vector<Mat> rvecs, tvecs;
-    calibrateCamera(worldPoints, imagePoints, grid_size, cameraMatrix, distortionCoefficiens, rvecs, tvecs);
+    return calibrateCamera(worldPoints, imagePoints, image_size, cameraMatrix, distortionCoefficiens, rvecs, tvecs);
 }
 
 double calibrateAndReproject(vector<vector<Point2f>> imagePoints, Size grid_size, float radius, Mat& cameraMatrix, Mat& distortionCoefficiens) {
@@ -38,7 +38,7 @@ double calibrateAndReproject(vector<vector<Point2f>> imagePoints, Size grid_size
     int iFixedPoint = -1;
     vector<Mat> rvecs, tvecs;
     double rms = calibrateCameraRO(worldPoints, imagePoints, grid_size, iFixedPoint, cameraMatrix, distortionCoefficiens, rvecs, tvecs, newObjectPoints, CALIB_USE_LU);
-    cout << "reprojection error reported by calibrateCameraRO: " << rms << endl;
+    LOG(Debug, Calibration, "reprojection error reported by calibrateCameraRO: {}", rms);
     
     // compute average error:
     worldPoints.clear();
@@ -53,130 +53,617 @@ double calibrateAndReproject(vector<vector<Point2f>> imagePoints, Size grid_size
         err = norm(imagePoints[i], imagePoints2, NORM_L2);
 
         size_t n = worldPoints[i].size();
-        cout << "Per view error: " << i << ": " << err * err / n << endl;
+        LOG(Debug, Calibration, "Per view error: {}: {}", i, err * err / n);
         totalError += err * err;
         totalPoints += n;
     }
 
     double average_error = std::sqrt(totalError / totalPoints);
-    cout << "average error: " << average_error << endl;
+    LOG(Debug, Calibration, "average error: {}", average_error);
     return average_error;
 }
 
 
+// binary file identifiers, bump the versions whenever the layout changes
+static const char CALIBRATION_MAGIC[4] = {'V', 'S', 'C', 'B'};
+static const uint32_t CALIBRATION_VERSION = 1;
+static const char DETECTION_CACHE_MAGIC[4] = {'V', 'S', 'D', 'C'};
+static const uint32_t DETECTION_CACHE_VERSION = 1;
+
+// grid detection of a single calibration image
+struct CachedDetection {
+    bool found = false;
+    Size imageSize;
+    vector<Point2f> points;
+};
+
+uint64_t hashBytes(const vector<uchar>& bytes) {
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < bytes.size(); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool readFileBytes(string fileName, vector<uchar>& bytes) {
+    ifstream inStream(fileName, ios::binary | ios::ate);
+    if(!inStream) return false;
+
+    streamoff size = inStream.tellg();
+    if(size <= 0) return false;
+    bytes.resize((size_t) size);
+    inStream.seekg(0);
+    return (bool) inStream.read((char*) bytes.data(), size);
+}
+
+template<typename T>
+void writeValue(ofstream& outStream, const T& value) {
+    outStream.write((const char*) &value, sizeof(T));
+}
+
+template<typename T>
+bool readValue(ifstream& inStream, T& value) {
+    return (bool) inStream.read((char*) &value, sizeof(T));
+}
+
+/// <sumary>
+/// Reads the grid detections saved by previous calibrations. Detections made with a different grid are discarded.
+/// </sumary>
+/// <param name="fileName">Path to the detection cache</param>
+/// <param name="grid_size">Grid the detections have to be made with</param>
+/// <param name="cache">Detections keyed by the content hash of their image</param>
+void readDetectionCache(string fileName, Size grid_size, map<uint64_t, CachedDetection>& cache) {
+    cache.clear();
+    ifstream inStream(fileName, ios::binary);
+    if(!inStream) return;
+
+    char magic[4];
+    uint32_t version, count;
+    int32_t grid_width, grid_height;
+    if(!inStream.read(magic, 4) || memcmp(magic, DETECTION_CACHE_MAGIC, 4) != 0) return;
+    if(!readValue(inStream, version) || version != DETECTION_CACHE_VERSION) return;
+    if(!readValue(inStream, grid_width) || !readValue(inStream, grid_height)) return;
+    if(grid_width != grid_size.width || grid_height != grid_size.height) return;
+    if(!readValue(inStream, count)) return;
+
+    size_t num_points = (size_t) grid_size.area();
+    for(uint32_t i = 0; i < count; i++) {
+        uint64_t hash;
+        uint8_t found;
+        int32_t width, height;
+        if(!readValue(inStream, hash) || !readValue(inStream, found) || !readValue(inStream, width) || !readValue(inStream, height)) break;
+
+        CachedDetection detection;
+        detection.found = found != 0;
+        detection.imageSize = Size(width, height);
+        if(detection.found) {
+            detection.points.resize(num_points);
+            if(!inStream.read((char*) detection.points.data(), num_points * sizeof(Point2f))) break;
+        }
+        cache[hash] = detection;
+    }
+}
+
+void writeDetectionCache(string fileName, Size grid_size, const map<uint64_t, CachedDetection>& cache) {
+    ofstream outStream(fileName, ios::binary | ios::trunc);
+    if(!outStream) {
+        LOG(Warning, Calibration, "Could not write to detection cache");
+        return;
+    }
+
+    outStream.write(DETECTION_CACHE_MAGIC, 4);
+    writeValue(outStream, DETECTION_CACHE_VERSION);
+    writeValue(outStream, (int32_t) grid_size.width);
+    writeValue(outStream, (int32_t) grid_size.height);
+    writeValue(outStream, (uint32_t) cache.size());
+    for(auto& entry : cache) {
+        writeValue(outStream, entry.first);
+        writeValue(outStream, (uint8_t) entry.second.found);
+        writeValue(outStream, (int32_t) entry.second.imageSize.width);
+        writeValue(outStream, (int32_t) entry.second.imageSize.height);
+        if(entry.second.found) {
+            outStream.write((const char*) entry.second.points.data(), entry.second.points.size() * sizeof(Point2f));
+        }
+    }
+}
+
+// calibration pattern
+static const Size CAL_GRID_SIZE(7, 5);              // num cols, num rows; on the pattern used for calibration
+static const float CAL_SQUARE_SIZE = 0.015f;        // side of a square on grid, generated by 4 grid points
+static const int MAX_VIEWS = 25;                    // largest number of views chosen for the calibration
+
+// view selection: the image is split into cells, views are preferred when they cover cells that few chosen views cover
+static const int COVERAGE_COLS = 8;
+static const int COVERAGE_ROWS = 6;
+static const double POSE_WEIGHT = 4;                // gain of a view with an unused pose, in freshly covered cells
+static const double DUPLICATE_ANGLE = 3;            // degrees, views with the same pose this close are near-duplicates
+static const double DUPLICATE_SHIFT = 0.05;         // grid center distance as a fraction of the image diagonal
+
+// grid detection that may be used for the calibration
+struct CalibrationView {
+    int image_num;                      // number of the calibration image or video frame
+    vector<Point2f> points;
+    vector<int> cells;                  // coverage cells inside the grid
+    int pose_bin;                       // tilt, tilt direction and grid size, quantized
+    double tilt;                        // angle between the grid normal and the optical axis, in degrees
+    double direction;                   // direction the grid is tilted in, in degrees
+    Vec3d rvec;
+    Point2f center;
+};
+
+static vector<Point3f> gridWorldPoints(Size grid_size, float spacing) {
+    vector<Point3f> points;
+    for(int i = 0; i < grid_size.height; i++) {
+        for(int j = 0; j < grid_size.width; j++) {
+            points.push_back(Point3f(j * spacing, i * spacing, 0.0f));
+        }
+    }
+    return points;
+}
+
+/// <sumary>
+/// Computes the image coverage and the rough pose of a view. The pose is found with a guessed camera matrix,
+/// which is good enough to tell the views apart.
+/// </sumary>
+static void describeView(CalibrationView& view, Size image_size, Size grid_size, float spacing) {
+    // outline of the grid
+    vector<Point2f> outline = {
+        view.points[0], view.points[grid_size.width - 1],
+        view.points[grid_size.area() - 1], view.points[grid_size.area() - grid_size.width]
+    };
+    view.center = (outline[0] + outline[1] + outline[2] + outline[3]) * 0.25f;
+
+    view.cells.clear();
+    for(int r = 0; r < COVERAGE_ROWS; r++) {
+        for(int c = 0; c < COVERAGE_COLS; c++) {
+            Point2f cell_center((c + 0.5f) * image_size.width / COVERAGE_COLS, (r + 0.5f) * image_size.height / COVERAGE_ROWS);
+            if(pointPolygonTest(outline, cell_center, false) >= 0) view.cells.push_back(r * COVERAGE_COLS + c);
+        }
+    }
+
+    double focal_guess = max(image_size.width, image_size.height);
+    Matx33d cameraGuess(focal_guess, 0, image_size.width / 2.0, 0, focal_guess, image_size.height / 2.0, 0, 0, 1);
+    Vec3d tvec;
+    solvePnP(gridWorldPoints(grid_size, spacing), view.points, cameraGuess, noArray(), view.rvec, tvec);
+
+    Matx33d R;
+    Rodrigues(view.rvec, R);
+    // grid normal, facing the camera
+    Vec3d normal(R(0, 2), R(1, 2), R(2, 2));
+    if(normal[2] > 0) normal = -normal;
+    view.tilt = acos(min(1.0, -normal[2])) * 180 / CV_PI;
+    view.direction = atan2(normal[1], normal[0]) * 180 / CV_PI;
+
+    int tilt_bin = view.tilt < 10 ? 0 : view.tilt < 25 ? 1 : view.tilt < 40 ? 2 : 3;
+    int direction_bin = tilt_bin == 0 ? 0 : (int) ((view.direction + 180) / 90) % 4;
+    double area_rate = contourArea(outline) / image_size.area();
+    int size_bin = area_rate < 0.1 ? 0 : area_rate < 0.3 ? 1 : 2;
+    view.pose_bin = ((tilt_bin == 0 ? 0 : 1 + (tilt_bin - 1) * 4 + direction_bin) * 3) + size_bin;
+}
+
+/// <sumary>
+/// Greedily chooses a small set of diverse views. Every step takes the view that covers the least covered
+/// image cells and poses, near-duplicates of chosen views are never taken.
+/// </sumary>
+/// <param name="views">Views with found grids</param>
+/// <param name="max_views">Largest number of chosen views</param>
+/// <returns>Indices of the chosen views, in the order they were chosen</returns>
+static vector<size_t> selectCalibrationViews(const vector<CalibrationView>& views, Size image_size, int max_views) {
+    vector<int> cell_counts(COVERAGE_COLS * COVERAGE_ROWS, 0);
+    map<int, int> bin_counts;
+    vector<bool> available(views.size(), true);
+    vector<size_t> chosen;
+    double duplicate_shift = DUPLICATE_SHIFT * norm(Point2d(image_size.width, image_size.height));
+    int duplicates = 0;
+
+    while((int) chosen.size() < max_views) {
+        double best_gain = 0;
+        size_t best = views.size();
+        for(size_t i = 0; i < views.size(); i++) {
+            if(!available[i]) continue;
+
+            double gain = POSE_WEIGHT / (1 + bin_counts[views[i].pose_bin]);
+            for(size_t c = 0; c < views[i].cells.size(); c++) gain += 1.0 / (1 + cell_counts[views[i].cells[c]]);
+            if(gain > best_gain) {
+                best_gain = gain;
+                best = i;
+            }
+        }
+        if(best == views.size()) break;
+
+        const CalibrationView& view = views[best];
+        int new_cells = 0;
+        for(size_t c = 0; c < view.cells.size(); c++) {
+            if(cell_counts[view.cells[c]]++ == 0) new_cells++;
+        }
+        bool new_pose = bin_counts[view.pose_bin]++ == 0;
+        available[best] = false;
+        chosen.push_back(best);
+        LOG(Info, Calibration, "Chose view {}, {} new of {} cells, {} pose: tilt {} deg towards {} deg",
+            view.image_num, new_cells, view.cells.size(), new_pose ? "new" : "repeated", view.tilt, view.direction);
+
+        // views that would add nothing over the chosen one
+        for(size_t i = 0; i < views.size(); i++) {
+            if(!available[i] || views[i].pose_bin != view.pose_bin) continue;
+
+            Matx33d R_chosen, R_other;
+            Rodrigues(view.rvec, R_chosen);
+            Rodrigues(views[i].rvec, R_other);
+            Vec3d rotation_difference;
+            Rodrigues(R_chosen.t() * R_other, rotation_difference);
+            if(norm(rotation_difference) * 180 / CV_PI < DUPLICATE_ANGLE && norm(views[i].center - view.center) < duplicate_shift) {
+                available[i] = false;
+                duplicates++;
+            }
+        }
+    }
+
+    int covered = 0;
+    for(size_t c = 0; c < cell_counts.size(); c++) {
+        if(cell_counts[c] > 0) covered++;
+    }
+    LOG(Info, Calibration, "Chose {} of {} views covering {} of {} cells in {} poses, {} near-duplicates skipped",
+        chosen.size(), views.size(), covered, cell_counts.size(), bin_counts.size(), duplicates);
+    return chosen;
+}
+
+/// <sumary>
+/// Reprojection error of the calibration over all views, also the ones that were not chosen.
+/// </sumary>
+static double viewsReprojectionError(const vector<CalibrationView>& views, Size grid_size, float spacing, const Mat& cameraMatrix, const Mat& distortionCoefficients) {
+    vector<Point3f> worldPoints = gridWorldPoints(grid_size, spacing);
+    vector<Point2f> projected;
+    double total_error = 0;
+    size_t total_points = 0;
+    for(size_t i = 0; i < views.size(); i++) {
+        Vec3d rvec, tvec;
+        solvePnP(worldPoints, views[i].points, cameraMatrix, distortionCoefficients, rvec, tvec);
+        projectPoints(worldPoints, rvec, tvec, cameraMatrix, distortionCoefficients, projected);
+        double error = norm(views[i].points, projected, NORM_L2);
+        total_error += error * error;
+        total_points += worldPoints.size();
+    }
+    return total_points > 0 ? sqrt(total_error / total_points) : 0;
+}
+
+
+/// <sumary>
+/// Calibrates the camera with a diverse subset of the views and saves the calibration.
+/// </sumary>
+/// <param name="fileName">Path to the calibration file</param>
+/// <param name="views">Views with found grids, all of the same image size</param>
+/// <returns>False if there are no views or the calibration could not be saved</returns>
+static bool calibrateViews(string fileName, const vector<CalibrationView>& views, Size image_size) {
+    if(views.empty()) {
+        LOG(Error, Calibration, "No circle grid found, cannot calibrate");
+        return false;
+    }
+
+    Mat cameraMatrix = Mat::eye(3, 3, CV_64F);
+    Mat distortionCoefficients = Mat::zeros(8, 1, CV_64F);
+
+    // near-duplicate views only make the calibration slower
+    vector<size_t> chosen = selectCalibrationViews(views, image_size, MAX_VIEWS);
+    vector<vector<Point2f>> imagePoints;
+    for(size_t i = 0; i < chosen.size(); i++) {
+        imagePoints.push_back(views[chosen[i]].points);
+    }
+
+    
+    // compute camera matrix and distortion coefficients
+    
+    LOG(Info, Calibration, "Calibrating");
+    int64 calibration_start = getTickCount();
+    // cameraCalibration(imagePoints, cal_grid_size, cal_dot_r, cameraMatrix, distortionCoefficients);
+    CalibrationData calibration;
+    calibration.rms = cameraCalibration(imagePoints, image_size, CAL_GRID_SIZE, CAL_SQUARE_SIZE, cameraMatrix, distortionCoefficients);
+    calibration.cameraMatrix = cameraMatrix;
+    calibration.distortionCoefficients = distortionCoefficients;
+    calibration.imageSize = image_size;
+    
+    LOG(Info, Calibration, "Calibration done in {} s, RMS: {}", (getTickCount() - calibration_start) / getTickFrequency(), calibration.rms);
+    LOG(Info, Calibration, "RMS over all {} views: {}", views.size(),
+        viewsReprojectionError(views, CAL_GRID_SIZE, CAL_SQUARE_SIZE, cameraMatrix, distortionCoefficients));
+
+    // save matrices
+    if(!CamCalib::writeCalibrationData(fileName, calibration)) {
+        LOG(Error, Calibration, "Could not write to calibration file");
+        return false;
+    }
+    LOG(Info, Calibration, "Calibration saved");
+    return true;
+}
+
+
 int CamCalib::myCalibrateCamera(string fileName, bool preview) {
-    int limit = 75;                     // limit the number of images needed
     double max_reprojection_error = 0.01;  // threshold at which the calibration is good enough    TODO: find proper threshold
-    bool first = true;
     int num_images = 100;                // number of images used for calibration
-    Size cal_grid_size(7,5);            // num cols, num rows; on the pattern used for calibration
+    Size cal_grid_size = CAL_GRID_SIZE;
     float cal_dot_r = 0.006f;           // single dot on grid radius in m
-    float cal_square_size = 0.015f;     // side of a square on grid, generated by 4 grid points
-    vector<vector<Point2f>> imagePoints;
+    vector<CalibrationView> views;
+    Size image_size;
     String window_name = "Calibration Preview";
-
-    
-    Mat cameraMatrix = Mat::eye(3, 3, CV_64F);
-    Mat distortionCoefficients = Mat::zeros(8, 1, CV_64F);
-    
+    string cache_file_name = "Calibration/detections.cache";
 
     if(preview) {
         namedWindow(window_name, WINDOW_NORMAL);
     }
 
+    // detections of images that were already processed, only new images need to be searched
+    map<uint64_t, CachedDetection> cache, used_cache;
+    readDetectionCache(cache_file_name, cal_grid_size, cache);
+    bool cache_changed = false;
+    FrameQualityFilter quality_filter;
+
     int count = 0;
     for(int img_num = 0; img_num < num_images; img_num++) {
         // open image files
         string file_name = format("Calibration/CAL_IMG (%d).png", img_num);
-        Mat cal_image = imread(file_name);
-        if(!cal_image.data) continue;
-
-        // pre-process image
-        // threshold(cal_image, cal_image, 127, 255, THRESH_OTSU);
+        vector<uchar> file_bytes;
+        if(!readFileBytes(file_name, file_bytes)) continue;
+        uint64_t hash = hashBytes(file_bytes);
+
+        Mat cal_image;
+        CachedDetection detection;
+        auto cached = cache.find(hash);
+        if(cached != cache.end()) {
+            detection = cached->second;
+        } else {
+            cal_image = imdecode(file_bytes, IMREAD_COLOR);
+            if(!cal_image.data) continue;
+
+            // blurred images are not cached, they are checked again once they are replaced
+            if(!quality_filter.accept(cal_image)) {
+                LOG(Warning, Calibration, "Skipping IMG: {}, blurred or badly exposed", img_num);
+                continue;
+            }
 
-        // flip image
-        // flip(cal_image, cal_image, 0);
+            // pre-process image
+            // threshold(cal_image, cal_image, 127, 255, THRESH_OTSU);
 
-        // find pattern
-        vector<Point2f> pointBuf;
-        bool found = findCirclesGrid(cal_image, cal_grid_size, pointBuf, CALIB_CB_ADAPTIVE_THRESH);
+            // flip image
+            // flip(cal_image, cal_image, 0);
 
-        if(found) {
-            cout << "Found circle grid, IMG: " << img_num << endl;
+            // find pattern
+            detection.imageSize = cal_image.size();
+            detection.found = findCirclesGrid(cal_image, cal_grid_size, detection.points, CALIB_CB_ADAPTIVE_THRESH);
+            cache_changed = true;
+        }
+        used_cache[hash] = detection;
 
-            count++;
+        if(preview && !cal_image.data) cal_image = imdecode(file_bytes, IMREAD_COLOR);
 
-            imagePoints.push_back(pointBuf);
-            
-            if(first) {
-                first = false;
+        if(detection.found) {
+            if(image_size.area() == 0) image_size = detection.imageSize;
+            if(detection.imageSize != image_size) {
+                LOG(Warning, Calibration, "Skipping IMG: {}, size differs from the other calibration images", img_num);
                 continue;
             }
 
-            
-            // calibrate
-            cameraMatrix = Mat::eye(3, 3, CV_64F);
-            distortionCoefficients = Mat::zeros(8, 1, CV_64F);
-            // double reprojectionError = calibrateAndReproject(imagePoints, cal_grid_size, cal_dot_r, cameraMatrix, distortionCoefficients);
-            double reprojectionError = calibrateAndReproject(imagePoints, cal_grid_size, cal_square_size, cameraMatrix, distortionCoefficients);
-            // cout << "Current reprojectionError: " << reprojectionError << endl;
-            
+            LOG(Info, Calibration, "Found circle grid, IMG: {}{}", img_num, cached != cache.end() ? " (cached)" : "");
+
+            count++;
+
+            CalibrationView view;
+            view.image_num = img_num;
+            view.points = detection.points;
+            describeView(view, image_size, cal_grid_size, CAL_SQUARE_SIZE);
+            views.push_back(view);
 
             if(preview) {
                 // display and save image
-                drawChessboardCorners(cal_image, cal_grid_size, Mat(pointBuf), found);
+                drawChessboardCorners(cal_image, cal_grid_size, Mat(detection.points), detection.found);
                 string file_name = format("UsedCalibrationImages/Saved_%03d.png", img_num);
                 bool created = imwrite(file_name, cal_image);
-                cout << file_name << " created: " << created << endl;
-                // cout << "Current reprojection error: " << reprojectionError << endl;
+                LOG(Debug, Calibration, "{} created: {}", file_name, created);
             }
-
-            // if(reprojectionError <= )
         }
 
         // display image
         if(preview)imshow(window_name, cal_image);
+    }
 
-        // break out of the loop for faster testing
-        if(count >= limit) break;
+    // keep only the detections of images that still exist
+    if(cache_changed || used_cache.size() != cache.size()) {
+        writeDetectionCache(cache_file_name, cal_grid_size, used_cache);
     }
 
-    
-    // compute camera matrix and distortion coefficients
-    
-    cout << "Calibrating" << endl;
-//     Mat cameraMatrix = Mat::eye(3, 3, CV_64F);
-//     Mat distortionCoefficients = Mat::zeros(8, 1, CV_64F);
-    // cameraCalibration(imagePoints, cal_grid_size, cal_dot_r, cameraMatrix, distortionCoefficients);
-    cameraCalibration(imagePoints, cal_grid_size, cal_square_size, cameraMatrix, distortionCoefficients);
-    
-    cout << "Calibration done" << endl;
+    calibrateViews(fileName, views, image_size);
+    return count;
+}
 
-    // save matrices
-    ofstream outStream(fileName);
-    if(outStream) {
-
-        // save camera matrix
-        for(int r = 0; r < cameraMatrix.rows; r++) {
-            for(int c = 0; c < cameraMatrix.cols; c++) {
-                double value = cameraMatrix.at<double>(r, c);
-                outStream << value << endl;
+/// <sumary>
+/// Calibrates the camera with frames sampled from a video of the calibration pattern. The frames are streamed
+/// from the decoder, blurry frames and frames that barely differ from the last kept one are dropped
+/// before the grid search, which runs on batches of frames in parallel. No frames are written to disk.
+/// </sumary>
+/// <param name="fileName">Path to the calibration file</param>
+/// <param name="videoName">Path to the calibration video</param>
+/// <param name="preview">Should the found grids be displayed</param>
+/// <returns>Number of frames in which the grid was found</returns>
+int CamCalib::calibrateFromVideo(string fileName, string videoName, bool preview) {
+    int sample_stride = 5;              // only every n-th frame is decoded
+    int batch_size = 16;                // frames searched for the grid in parallel
+    double blur_rate = 0.6;             // frames less sharp than this fraction of the running average are dropped
+    double min_difference = 4;          // mean gray level change to the last kept frame, below which a frame is redundant
+    Size sharpness_size(320, 240);      // size of the copies the frames are checked on
+    Size thumbnail_size(64, 48);
+    String window_name = "Calibration Preview";
+
+    VideoCapture cap(videoName);
+    if(!cap.isOpened()) {
+        LOG(Error, Calibration, "Cannot open the calibration video {}", videoName);
+        return 0;
+    }
+    if(preview) namedWindow(window_name, WINDOW_NORMAL);
+
+    vector<CalibrationView> views;
+    Size image_size;
+    vector<Mat> batch;
+    vector<int> batch_frames;
+    FrameQualityFilter quality_filter;
+    quality_filter.blur_rate = blur_rate;
+    quality_filter.sample_size = sharpness_size;
+    Mat frame, thumbnail, last_thumbnail;
+    int sampled = 0, blurred = 0, redundant = 0;
+    for(int frame_num = 0; ; frame_num++) {
+        bool ended = !cap.grab();
+        if(!ended && frame_num % sample_stride == 0 && cap.retrieve(frame)) {
+            sampled++;
+            if(image_size.area() == 0) image_size = frame.size();
+
+            // cheap checks on a small copy, before the expensive grid search
+            bool sharp = quality_filter.accept(frame);
+            resize(quality_filter.getLastSample(), thumbnail, thumbnail_size, 0, 0, INTER_AREA);
+            if(frame.size() != image_size) {
+                LOG(Warning, Calibration, "Skipping frame {}, size differs from the other frames", frame_num);
+            } else if(!sharp) {
+                blurred++;
+            } else if(!last_thumbnail.empty() && norm(thumbnail, last_thumbnail, NORM_L1) / thumbnail.total() < min_difference) {
+                redundant++;
+            } else {
+                thumbnail.copyTo(last_thumbnail);
+                batch.push_back(Mat());
+                cvtColor(frame, batch.back(), COLOR_BGR2GRAY);
+                batch_frames.push_back(frame_num);
             }
         }
 
-        // save distortion coefficients
-        for(int r = 0; r < distortionCoefficients.rows; r++) {
-            double value = distortionCoefficients.at<double>(r, 0);
-            outStream << value << endl;
+        if(batch.size() >= (size_t) batch_size || (ended && !batch.empty())) {
+            vector<vector<Point2f>> points(batch.size());
+            vector<uchar> found(batch.size());
+            parallel_for_(Range(0, (int) batch.size()), [&](const Range& range) {
+                for(int i = range.start; i < range.end; i++) {
+                    found[i] = findCirclesGrid(batch[i], CAL_GRID_SIZE, points[i], CALIB_CB_ADAPTIVE_THRESH);
+                }
+            });
+
+            for(size_t i = 0; i < batch.size(); i++) {
+                if(!found[i]) continue;
+
+                LOG(Info, Calibration, "Found circle grid, frame: {}", batch_frames[i]);
+                CalibrationView view;
+                view.image_num = batch_frames[i];
+                view.points = points[i];
+                describeView(view, image_size, CAL_GRID_SIZE, CAL_SQUARE_SIZE);
+                views.push_back(view);
+
+                if(preview) {
+                    Mat preview_image;
+                    cvtColor(batch[i], preview_image, COLOR_GRAY2BGR);
+                    drawChessboardCorners(preview_image, CAL_GRID_SIZE, Mat(points[i]), true);
+                    imshow(window_name, preview_image);
+                    waitKey(1);
+                }
+            }
+            batch.clear();
+            batch_frames.clear();
         }
 
-        outStream.close();
-        cout << "Calibration saved" << endl;
-    } else {
-        cout << "Could not write to calibration file" << endl;
+        if(ended) break;
     }
 
-    return count;
+    LOG(Info, Calibration, "Sampled {} frames, dropped {} blurry and {} redundant, grid found in {}", sampled, blurred, redundant, views.size());
+    calibrateViews(fileName, views, image_size);
+    return (int) views.size();
+}
+
+/// <sumary>
+/// Writes the calibration into a versioned binary file.
+/// </sumary>
+/// <param name="fileName">Path to the calibration file</param>
+/// <param name="data">Calibration to save</param>
+/// <returns>True if the file was written</returns>
+bool CamCalib::writeCalibrationData(string fileName, const CalibrationData& data) {
+    Mat cameraMatrix, distCoeff;
+    data.cameraMatrix.convertTo(cameraMatrix, CV_64F);
+    data.distortionCoefficients.reshape(1, (int) data.distortionCoefficients.total()).convertTo(distCoeff, CV_64F);
+    if(cameraMatrix.rows != 3 || cameraMatrix.cols != 3) return false;
+
+    ofstream outStream(fileName, ios::binary | ios::trunc);
+    if(!outStream) return false;
+
+    outStream.write(CALIBRATION_MAGIC, 4);
+    writeValue(outStream, CALIBRATION_VERSION);
+    writeValue(outStream, (int32_t) data.imageSize.width);
+    writeValue(outStream, (int32_t) data.imageSize.height);
+    writeValue(outStream, data.rms);
+
+    for(int r = 0; r < 3; r++) {
+        for(int c = 0; c < 3; c++) {
+            writeValue(outStream, cameraMatrix.at<double>(r, c));
+        }
+    }
+
+    writeValue(outStream, (int32_t) distCoeff.rows);
+    for(int r = 0; r < distCoeff.rows; r++) {
+        writeValue(outStream, distCoeff.at<double>(r, 0));
+    }
+
+    return (bool) outStream;
+}
+
+/// <sumary>
+/// Reads and validates a calibration file written by writeCalibrationData.
+/// </sumary>
+/// <param name="fileName">Path to the calibration file</param>
+/// <param name="data">Calibration that was read, only changed on success</param>
+/// <returns>False if the file is missing, of another version or holds invalid values</returns>
+bool CamCalib::readCalibrationData(string fileName, CalibrationData& data) {
+    ifstream inStream(fileName, ios::binary);
+    if(!inStream) return false;
+
+    char magic[4];
+    uint32_t version;
+    int32_t width, height, num_coefficients;
+    double rms;
+    if(!inStream.read(magic, 4) || memcmp(magic, CALIBRATION_MAGIC, 4) != 0) {
+        LOG(Warning, Calibration, "Calibration file has an unknown format");
+        return false;
+    }
+    if(!readValue(inStream, version) || version != CALIBRATION_VERSION) {
+        LOG(Warning, Calibration, "Calibration file has an unsupported version");
+        return false;
+    }
+    if(!readValue(inStream, width) || !readValue(inStream, height) || !readValue(inStream, rms)) return false;
+
+    Mat cameraMatrix(3, 3, CV_64F);
+    for(int r = 0; r < 3; r++) {
+        for(int c = 0; c < 3; c++) {
+            if(!readValue(inStream, cameraMatrix.at<double>(r, c))) return false;
+        }
+    }
+
+    if(!readValue(inStream, num_coefficients)) return false;
+    if(num_coefficients != 4 && num_coefficients != 5 && num_coefficients != 8 && num_coefficients != 12 && num_coefficients != 14) {
+        LOG(Warning, Calibration, "Calibration file has an invalid distortion model");
+        return false;
+    }
+    Mat distCoeff(num_coefficients, 1, CV_64F);
+    for(int r = 0; r < num_coefficients; r++) {
+        if(!readValue(inStream, distCoeff.at<double>(r, 0))) return false;
+    }
+
+    // nothing may follow the coefficients
+    if(inStream.peek() != char_traits<char>::eof()) {
+        LOG(Warning, Calibration, "Calibration file has trailing data");
+        return false;
+    }
+
+    // sanity check the values
+    if(width <= 0 || height <= 0 || !checkRange(cameraMatrix) || !checkRange(distCoeff) || !std::isfinite(rms)
+       || cameraMatrix.at<double>(0, 0) <= 0 || cameraMatrix.at<double>(1, 1) <= 0 || cameraMatrix.at<double>(2, 2) != 1) {
+        LOG(Warning, Calibration, "Calibration file holds invalid values");
+        return false;
+    }
+
+    data.cameraMatrix = cameraMatrix;
+    data.distortionCoefficients = distCoeff;
+    data.imageSize = Size(width, height);
+    data.rms = rms;
+    return true;
 }
 
 CamCalib::CamCalib() {}
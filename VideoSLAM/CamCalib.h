@@ -3,11 +3,24 @@
 
 #include "stdafx.h"
 
+// result of a camera calibration, as stored in the binary calibration file
+struct CalibrationData {
+    cv::Mat cameraMatrix;               // 3x3, CV_64F
+    cv::Mat distortionCoefficients;     // 4, 5, 8, 12 or 14 x 1, CV_64F; the row count is the distortion model
+    cv::Size imageSize;
+    double rms = -1;                    // reprojection error reported by the calibration
+};
+
+double calibrateAndReproject(std::vector<std::vector<cv::Point2f>> imagePoints, cv::Size grid_size, float radius, cv::Mat& cameraMatrix, cv::Mat& distortionCoefficiens);
+
 class CamCalib {
     public:
         int myCalibrateCamera(std::string fileName, bool preview);
+        int calibrateFromVideo(std::string fileName, std::string videoName, bool preview);
+        static bool writeCalibrationData(std::string fileName, const CalibrationData& data);
+        static bool readCalibrationData(std::string fileName, CalibrationData& data);
         CamCalib();
         virtual ~CamCalib();
 };
 
-#endif // CAMCALIB_H
\ No newline at end of file
+#endif // CAMCALIB_H
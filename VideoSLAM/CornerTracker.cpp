@@ -0,0 +1,103 @@
+#include "stdafx.h"
+#include "CornerTracker.h"
+
+using namespace std;
+using namespace cv;
+
+// a tracked marker, whose area changed more than this factor since the last frame, is lost
+static const double MAX_AREA_CHANGE = 2.0;
+
+CornerTracker::CornerTracker() {
+    this->window_size = Size(15, 15);
+    this->max_level = 2;
+    this->max_backward_error = 1.0;
+    this->margin_rate = 0.5;
+}
+
+CornerTracker::~CornerTracker() = default;
+
+/// <sumary>
+/// Starts following the markers of a full detection.
+/// </sumary>
+/// <param name="frame">Grayscale or BGR frame, the markers were detected in</param>
+/// <param name="ids">IDs of the detected markers</param>
+/// <param name="corners">Corners of the detected markers</param>
+void CornerTracker::reset(const Mat& frame, const vector<int>& ids, const vector<vector<Point2f>>& corners) {
+    markers.resize(ids.size());
+    for(size_t i = 0; i < ids.size(); i++) {
+        markers[i].id = ids[i];
+        markers[i].corners = corners[i];
+        cutPatch(frame, markers[i]);
+    }
+}
+
+/// <sumary>
+/// Finds the followed markers in the next frame. A corner is tracked from the last patch into the same area
+/// of the new frame and back, the marker is lost if any of its corners does not return to where it started.
+/// </sumary>
+/// <param name="frame">Grayscale or BGR frame, following the last one</param>
+/// <param name="ids">IDs of the tracked markers</param>
+/// <param name="corners">Tracked corners, in the same order as aruco::detectMarkers returns them</param>
+/// <returns>False if a marker was lost or there is nothing to follow, the frame then needs a full detection</returns>
+bool CornerTracker::track(const Mat& frame, vector<int>& ids, vector<vector<Point2f>>& corners) {
+    ids.clear();
+    corners.resize(markers.size());
+    if(markers.empty()) return false;
+
+    TermCriteria criteria(TermCriteria::COUNT | TermCriteria::EPS, 20, 0.03);
+    size_t kept = 0;
+    for(size_t i = 0; i < markers.size(); i++) {
+        TrackedMarker& marker = markers[i];
+        Point2f offset((float) marker.patch_rect.x, (float) marker.patch_rect.y);
+
+        // the same area of the new frame, markers moving farther than the margin are lost
+        const Mat area = frame(marker.patch_rect);
+        if(area.channels() == 3) cvtColor(area, current_patch, COLOR_BGR2GRAY);
+        else area.copyTo(current_patch);
+
+        previous_points.resize(4);
+        for(int k = 0; k < 4; k++) previous_points[k] = marker.corners[k] - offset;
+
+        calcOpticalFlowPyrLK(marker.patch, current_patch, previous_points, next_points, status, errors, window_size, max_level, criteria);
+        calcOpticalFlowPyrLK(current_patch, marker.patch, next_points, back_points, back_status, errors, window_size, max_level, criteria);
+
+        bool found = true;
+        for(int k = 0; k < 4 && found; k++) {
+            found = status[k] && back_status[k] && norm(back_points[k] - previous_points[k]) <= max_backward_error;
+        }
+        if(found) {
+            // the corners have to form the same kind of quadrilateral as before
+            double previous_area = contourArea(previous_points), next_area = contourArea(next_points);
+            found = isContourConvex(next_points) && next_area * MAX_AREA_CHANGE >= previous_area && next_area <= previous_area * MAX_AREA_CHANGE;
+        }
+        if(!found) {
+            LOG(Trace, Detection, "Lost the corners of marker {}", marker.id);
+            continue;
+        }
+
+        for(int k = 0; k < 4; k++) marker.corners[k] = next_points[k] + offset;
+        cutPatch(frame, marker);
+        if(kept != i) swap(markers[kept], marker);
+        kept++;
+    }
+
+    bool all_found = kept == markers.size();
+    markers.resize(kept);
+    corners.resize(kept);
+    for(size_t i = 0; i < kept; i++) {
+        ids.push_back(markers[i].id);
+        corners[i] = markers[i].corners;
+    }
+    return all_found;
+}
+
+// grayscale patch around the marker, into which its corners are tracked in the next frame
+void CornerTracker::cutPatch(const Mat& frame, TrackedMarker& marker) {
+    Rect box = boundingRect(marker.corners);
+    int margin = max(window_size.width, (int) (margin_rate * max(box.width, box.height)));
+    marker.patch_rect = Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & Rect(0, 0, frame.cols, frame.rows);
+
+    const Mat area = frame(marker.patch_rect);
+    if(area.channels() == 3) cvtColor(area, marker.patch, COLOR_BGR2GRAY);
+    else area.copyTo(marker.patch);
+}
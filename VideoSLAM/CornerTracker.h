@@ -0,0 +1,47 @@
+#ifndef CORNER_TRACKER_H
+#define CORNER_TRACKER_H
+
+#include <vector>
+
+
+/// <sumary>
+/// Follows the corners of detected markers from frame to frame with pyramidal Lucas-Kanade optical flow.
+/// Only a small patch around each marker is converted and searched, so following the markers is far cheaper
+/// than detecting them in the whole frame. Every track is checked by tracking it back to the previous frame.
+/// </sumary>
+class CornerTracker {
+public:
+    // attributes
+    cv::Size window_size;               // Lucas-Kanade window
+    int max_level;                      // pyramid levels above the patch
+    double max_backward_error;          // pixels, a corner tracked back further from where it started is lost
+    double margin_rate;                 // patch margin around the marker, as a fraction of the marker's size
+
+    // constructors & deconstructors
+    CornerTracker();
+    virtual ~CornerTracker();
+
+    // methods
+    void reset(const cv::Mat& frame, const std::vector<int>& ids, const std::vector<std::vector<cv::Point2f>>& corners);
+    bool track(const cv::Mat& frame, std::vector<int>& ids, std::vector<std::vector<cv::Point2f>>& corners);
+    size_t getTrackedCount() const { return markers.size(); }
+
+private:
+    // a marker that is followed, with the patch of the last frame it was found in
+    struct TrackedMarker {
+        int id;
+        std::vector<cv::Point2f> corners;
+        cv::Rect patch_rect;
+        cv::Mat patch;
+    };
+
+    std::vector<TrackedMarker> markers;
+    cv::Mat current_patch;
+    std::vector<cv::Point2f> previous_points, next_points, back_points;
+    std::vector<uchar> status, back_status;
+    std::vector<float> errors;
+
+    void cutPatch(const cv::Mat& frame, TrackedMarker& marker);
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#include "DetectionLog.h"
+
+using namespace std;
+using namespace cv;
+
+// layout: magic, version, then for every frame its number, timestamp, flags and marker count,
+// followed by the ID and the 4 corners of every marker
+static const char DETECTION_LOG_MAGIC[4] = {'V', 'S', 'D', 'L'};
+static const uint32_t DETECTION_LOG_VERSION = 2;
+static const uint8_t FRAME_BLURRED = 1;             // skipped by the quality filter, the frame has no detections
+static const uint32_t MAX_MARKERS_PER_FRAME = 4096;
+
+template<typename T>
+static void writeValue(ofstream& outStream, const T& value) {
+    outStream.write((const char*) &value, sizeof(T));
+}
+
+template<typename T>
+static bool readValue(ifstream& inStream, T& value) {
+    return (bool) inStream.read((char*) &value, sizeof(T));
+}
+
+DetectionLogWriter::DetectionLogWriter() = default;
+
+DetectionLogWriter::~DetectionLogWriter() {
+    close();
+}
+
+/// <sumary>
+/// Creates the log file, an existing one is overwritten.
+/// </sumary>
+/// <param name="fileName">Path to the log file</param>
+/// <returns>False if the file could not be created</returns>
+bool DetectionLogWriter::open(string fileName) {
+    close();
+    outStream.open(fileName, ios::binary | ios::trunc);
+    if(!outStream) {
+        LOG(Warning, Detection, "Could not create detection log: {}", fileName);
+        return false;
+    }
+
+    outStream.write(DETECTION_LOG_MAGIC, sizeof(DETECTION_LOG_MAGIC));
+    writeValue(outStream, DETECTION_LOG_VERSION);
+    addMetric(Metric::OutputBytes, sizeof(DETECTION_LOG_MAGIC) + sizeof(DETECTION_LOG_VERSION));
+    return true;
+}
+
+/// <sumary>
+/// Appends the detections of a frame. Frames without markers are written as well, so the replay keeps every frame.
+/// </sumary>
+/// <param name="blurred">The frame was skipped by the quality filter, the replay marks it the same way</param>
+void DetectionLogWriter::write(int frame_num, double timestamp, bool blurred, const vector<int>& ids, const vector<vector<Point2f>>& corners) {
+    if(!outStream.is_open()) return;
+
+    writeValue(outStream, (int32_t) frame_num);
+    writeValue(outStream, timestamp);
+    writeValue(outStream, (uint8_t) (blurred ? FRAME_BLURRED : 0));
+    writeValue(outStream, (uint32_t) ids.size());
+    for(size_t i = 0; i < ids.size(); i++) {
+        writeValue(outStream, (int32_t) ids[i]);
+        for(int k = 0; k < 4; k++) {
+            writeValue(outStream, corners[i][k].x);
+            writeValue(outStream, corners[i][k].y);
+        }
+    }
+    addMetric(Metric::OutputBytes, sizeof(int32_t) + sizeof(double) + sizeof(uint8_t) + sizeof(uint32_t) + ids.size() * (sizeof(int32_t) + 8 * sizeof(float)));
+}
+
+void DetectionLogWriter::close() {
+    if(outStream.is_open()) outStream.close();
+}
+
+DetectionLogReader::DetectionLogReader() = default;
+
+DetectionLogReader::~DetectionLogReader() = default;
+
+/// <sumary>
+/// Opens a log written by DetectionLogWriter.
+/// </sumary>
+/// <param name="fileName">Path to the log file</param>
+/// <returns>False if the file cannot be read or is not a detection log of this version</returns>
+bool DetectionLogReader::open(string fileName) {
+    inStream.open(fileName, ios::binary);
+    if(!inStream) {
+        LOG(Warning, Detection, "Could not read detection log: {}", fileName);
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version;
+    if(!inStream.read(magic, sizeof(magic)) || memcmp(magic, DETECTION_LOG_MAGIC, sizeof(magic)) != 0
+       || !readValue(inStream, version) || version != DETECTION_LOG_VERSION) {
+        LOG(Warning, Detection, "Not a detection log of version {}: {}", DETECTION_LOG_VERSION, fileName);
+        inStream.close();
+        return false;
+    }
+    return true;
+}
+
+/// <sumary>
+/// Reads the detections of the next frame.
+/// </sumary>
+/// <returns>False at the end of the log or if the log is truncated</returns>
+bool DetectionLogReader::read(int& frame_num, double& timestamp, bool& blurred, vector<int>& ids, vector<vector<Point2f>>& corners) {
+    int32_t num;
+    uint8_t flags;
+    uint32_t count;
+    if(!readValue(inStream, num) || !readValue(inStream, timestamp) || !readValue(inStream, flags) || !readValue(inStream, count)) return false;
+    if(count > MAX_MARKERS_PER_FRAME) {
+        LOG(Warning, Detection, "Corrupted detection log at frame {}", num);
+        return false;
+    }
+
+    frame_num = num;
+    blurred = (flags & FRAME_BLURRED) != 0;
+    ids.resize(count);
+    corners.resize(count);
+    for(uint32_t i = 0; i < count; i++) {
+        int32_t id;
+        if(!readValue(inStream, id)) return false;
+        ids[i] = id;
+
+        corners[i].resize(4);
+        for(int k = 0; k < 4; k++) {
+            if(!readValue(inStream, corners[i][k].x) || !readValue(inStream, corners[i][k].y)) return false;
+        }
+    }
+    return true;
+}
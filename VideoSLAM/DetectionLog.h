@@ -0,0 +1,39 @@
+#ifndef DETECTION_LOG_H
+#define DETECTION_LOG_H
+
+#include <fstream>
+
+
+// writes the marker detections of every frame into a binary file, that can be replayed without the video
+class DetectionLogWriter {
+public:
+    // constructors & deconstructors
+    DetectionLogWriter();
+    virtual ~DetectionLogWriter();
+
+    // methods
+    bool open(std::string fileName);
+    bool isOpen() const { return outStream.is_open(); }
+    void write(int frame_num, double timestamp, bool blurred, const std::vector<int>& ids, const std::vector<std::vector<cv::Point2f>>& corners);
+    void close();
+
+private:
+    std::ofstream outStream;
+};
+
+// reads the detections written by DetectionLogWriter, frame by frame
+class DetectionLogReader {
+public:
+    // constructors & deconstructors
+    DetectionLogReader();
+    virtual ~DetectionLogReader();
+
+    // methods
+    bool open(std::string fileName);
+    bool read(int& frame_num, double& timestamp, bool& blurred, std::vector<int>& ids, std::vector<std::vector<cv::Point2f>>& corners);
+
+private:
+    std::ifstream inStream;
+};
+
+#endif
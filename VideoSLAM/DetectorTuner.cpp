@@ -0,0 +1,245 @@
+#include "stdafx.h"
+#include "DetectorTuner.h"
+
+using namespace std;
+using namespace cv;
+
+// values the candidate parameters are sampled from
+static const int WIN_SIZE_MIN_VALUES[] = { 3, 5, 7, 11 };
+static const int WIN_SIZE_MAX_VALUES[] = { 15, 23, 33, 53 };
+static const int WIN_SIZE_STEP_VALUES[] = { 4, 6, 10, 20 };
+static const double THRESH_CONSTANT_VALUES[] = { 5, 7, 9 };
+static const double MIN_PERIMETER_RATE_VALUES[] = { 0.01, 0.02, 0.03, 0.05 };
+static const double MAX_PERIMETER_RATE_VALUES[] = { 2, 4 };
+static const double APPROX_ACCURACY_RATE_VALUES[] = { 0.03, 0.05, 0.08 };
+static const int CORNER_REFINEMENT_VALUES[] = { aruco::CORNER_REFINE_NONE, aruco::CORNER_REFINE_SUBPIX };
+
+template<typename T, size_t N>
+static T pick(RNG& rng, const T (&values)[N]) {
+    return values[rng.uniform(0, (int) N)];
+}
+
+/// <sumary>
+/// Creates a tuner for the sample frames. The reference detections are made with referenceParameters().
+/// </sumary>
+/// <param name="frames">Frames of the video, as the tracker gets them</param>
+/// <param name="use_fast_detector">Measure FastArucoDetector instead of aruco::detectMarkers</param>
+DetectorTuner::DetectorTuner(const vector<Mat>& frames, bool use_fast_detector) {
+    this->frames = frames;
+    this->use_fast_detector = use_fast_detector;
+    this->reference_count = 0;
+    setReference(referenceParameters());
+}
+
+DetectorTuner::~DetectorTuner() = default;
+
+/// <sumary>
+/// Detects the markers of the sample frames, against which the candidates are compared.
+/// The reference always uses aruco::detectMarkers, so the fast detector is measured against it as well.
+/// </sumary>
+void DetectorTuner::setReference(Ptr<aruco::DetectorParameters> parameters) {
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(DICTIONARY_NAME);
+    reference_ids.assign(frames.size(), vector<int>());
+    reference_corners.assign(frames.size(), vector<vector<Point2f>>());
+    reference_count = 0;
+
+    parallel_for_(Range(0, (int) frames.size()), [&](const Range& range) {
+        for(int i = range.start; i < range.end; i++) {
+            aruco::detectMarkers(frames[i], dictionary, reference_corners[i], reference_ids[i], parameters);
+        }
+    });
+
+    for(size_t i = 0; i < frames.size(); i++) reference_count += (int) reference_ids[i].size();
+}
+
+/// <sumary>
+/// Measures the candidates on the sample frames. Every candidate runs on a single worker thread, the detectors'
+/// own parallel loops are run sequentially inside it, so the times are comparable between the candidates.
+/// </sumary>
+/// <returns>Results in the order of the candidates</returns>
+vector<TuningResult> DetectorTuner::evaluate(const vector<Ptr<aruco::DetectorParameters>>& candidates) const {
+    vector<TuningResult> results(candidates.size());
+    parallel_for_(Range(0, (int) candidates.size()), [&](const Range& range) {
+        for(int i = range.start; i < range.end; i++) {
+            results[i] = measure(candidates[i]);
+        }
+    });
+    return results;
+}
+
+TuningResult DetectorTuner::measure(Ptr<aruco::DetectorParameters> parameters) const {
+    TuningResult result;
+    result.parameters = parameters;
+
+    Ptr<aruco::Dictionary> dictionary = aruco::getPredefinedDictionary(DICTIONARY_NAME);
+    FastArucoDetector<DICTIONARY_NAME> fast_detector(parameters);
+    vector<vector<Point2f>> corners, rejects;
+    vector<int> ids;
+
+    int64 ticks = 0;
+    int found = 0;
+    double corner_error_sum = 0;
+    for(size_t f = 0; f < frames.size(); f++) {
+        int64 start = getTickCount();
+        if(use_fast_detector) fast_detector.detectMarkers(frames[f], corners, ids, rejects);
+        else aruco::detectMarkers(frames[f], dictionary, corners, ids, parameters, rejects);
+        ticks += getTickCount() - start;
+
+        // match the detections to the reference by their IDs
+        for(size_t i = 0; i < ids.size(); i++) {
+            bool matched = false;
+            for(size_t j = 0; j < reference_ids[f].size() && !matched; j++) {
+                if(reference_ids[f][j] != ids[i]) continue;
+
+                matched = true;
+                found++;
+                for(int k = 0; k < 4; k++) corner_error_sum += norm(corners[i][k] - reference_corners[f][j][k]) / 4;
+            }
+            if(!matched) result.false_detections++;
+        }
+    }
+
+    if(!frames.empty()) result.ms_per_frame = 1000.0 * ticks / getTickFrequency() / frames.size();
+    if(reference_count > 0) result.recall = (double) found / reference_count;
+    if(found > 0) result.corner_error = corner_error_sum / found;
+    return result;
+}
+
+/// <sumary>
+/// Slow parameters that find as many markers as possible: a fine threshold window sweep, small markers
+/// and sub-pixel corners.
+/// </sumary>
+Ptr<aruco::DetectorParameters> DetectorTuner::referenceParameters() {
+    Ptr<aruco::DetectorParameters> parameters = aruco::DetectorParameters::create();
+    parameters->adaptiveThreshWinSizeMin = 3;
+    parameters->adaptiveThreshWinSizeMax = 53;
+    parameters->adaptiveThreshWinSizeStep = 2;
+    parameters->minMarkerPerimeterRate = 0.01;
+    parameters->maxMarkerPerimeterRate = 4;
+    parameters->cornerRefinementMethod = aruco::CORNER_REFINE_SUBPIX;
+    return parameters;
+}
+
+/// <sumary>
+/// Samples random parameter sets. The first one is always the default parameters.
+/// </sumary>
+/// <param name="count">Number of parameter sets</param>
+/// <param name="seed">Seed of the sampling, the same seed gives the same candidates</param>
+vector<Ptr<aruco::DetectorParameters>> DetectorTuner::sampleCandidates(int count, uint64_t seed) {
+    vector<Ptr<aruco::DetectorParameters>> candidates;
+    if(count <= 0) return candidates;
+
+    candidates.push_back(aruco::DetectorParameters::create());
+    RNG rng(seed);
+    while((int) candidates.size() < count) {
+        Ptr<aruco::DetectorParameters> parameters = aruco::DetectorParameters::create();
+        parameters->adaptiveThreshWinSizeMin = pick(rng, WIN_SIZE_MIN_VALUES);
+        parameters->adaptiveThreshWinSizeMax = pick(rng, WIN_SIZE_MAX_VALUES);
+        parameters->adaptiveThreshWinSizeStep = pick(rng, WIN_SIZE_STEP_VALUES);
+        parameters->adaptiveThreshConstant = pick(rng, THRESH_CONSTANT_VALUES);
+        parameters->minMarkerPerimeterRate = pick(rng, MIN_PERIMETER_RATE_VALUES);
+        parameters->maxMarkerPerimeterRate = pick(rng, MAX_PERIMETER_RATE_VALUES);
+        parameters->polygonalApproxAccuracyRate = pick(rng, APPROX_ACCURACY_RATE_VALUES);
+        parameters->cornerRefinementMethod = pick(rng, CORNER_REFINEMENT_VALUES);
+        candidates.push_back(parameters);
+    }
+    return candidates;
+}
+
+/// <sumary>
+/// Keeps the results, that no other result beats in both detection time and recall.
+/// </sumary>
+/// <returns>Frontier, sorted from the fastest to the one with the highest recall</returns>
+vector<TuningResult> DetectorTuner::paretoFrontier(vector<TuningResult> results) {
+    sort(results.begin(), results.end(), [](const TuningResult& a, const TuningResult& b) {
+        if(a.ms_per_frame != b.ms_per_frame) return a.ms_per_frame < b.ms_per_frame;
+        return a.recall > b.recall;
+    });
+
+    vector<TuningResult> frontier;
+    for(size_t i = 0; i < results.size(); i++) {
+        if(frontier.empty() || results[i].recall > frontier.back().recall) frontier.push_back(results[i]);
+    }
+    return frontier;
+}
+
+template<typename T>
+static void readField(const FileNode& node, const char* name, T& value) {
+    if(!node[name].empty()) node[name] >> value;
+}
+
+/// <sumary>
+/// Writes the detector parameters to a YAML or XML file, the format is chosen by the file extension.
+/// </sumary>
+bool saveDetectorParameters(string fileName, const Ptr<aruco::DetectorParameters>& parameters) {
+    FileStorage fs(fileName, FileStorage::WRITE);
+    if(!fs.isOpened()) {
+        LOG(Warning, Detection, "Cannot write the detector parameters to {}", fileName);
+        return false;
+    }
+
+    fs << "adaptiveThreshWinSizeMin" << parameters->adaptiveThreshWinSizeMin;
+    fs << "adaptiveThreshWinSizeMax" << parameters->adaptiveThreshWinSizeMax;
+    fs << "adaptiveThreshWinSizeStep" << parameters->adaptiveThreshWinSizeStep;
+    fs << "adaptiveThreshConstant" << parameters->adaptiveThreshConstant;
+    fs << "minMarkerPerimeterRate" << parameters->minMarkerPerimeterRate;
+    fs << "maxMarkerPerimeterRate" << parameters->maxMarkerPerimeterRate;
+    fs << "polygonalApproxAccuracyRate" << parameters->polygonalApproxAccuracyRate;
+    fs << "minCornerDistanceRate" << parameters->minCornerDistanceRate;
+    fs << "minDistanceToBorder" << parameters->minDistanceToBorder;
+    fs << "minMarkerDistanceRate" << parameters->minMarkerDistanceRate;
+    fs << "cornerRefinementMethod" << parameters->cornerRefinementMethod;
+    fs << "cornerRefinementWinSize" << parameters->cornerRefinementWinSize;
+    fs << "cornerRefinementMaxIterations" << parameters->cornerRefinementMaxIterations;
+    fs << "cornerRefinementMinAccuracy" << parameters->cornerRefinementMinAccuracy;
+    fs << "markerBorderBits" << parameters->markerBorderBits;
+    fs << "perspectiveRemovePixelPerCell" << parameters->perspectiveRemovePixelPerCell;
+    fs << "perspectiveRemoveIgnoredMarginPerCell" << parameters->perspectiveRemoveIgnoredMarginPerCell;
+    fs << "maxErroneousBitsInBorderRate" << parameters->maxErroneousBitsInBorderRate;
+    fs << "minOtsuStdDev" << parameters->minOtsuStdDev;
+    fs << "errorCorrectionRate" << parameters->errorCorrectionRate;
+    fs << "detectInvertedMarker" << (int) parameters->detectInvertedMarker;
+    return true;
+}
+
+/// <sumary>
+/// Reads detector parameters written by saveDetectorParameters. Values missing in the file are left unchanged.
+/// </sumary>
+/// <param name="parameters">Parameters, that are overwritten with the values of the file</param>
+/// <returns>False if the file cannot be read</returns>
+bool loadDetectorParameters(string fileName, Ptr<aruco::DetectorParameters>& parameters) {
+    FileStorage fs;
+    try {
+        if(!fs.open(fileName, FileStorage::READ)) return false;
+    } catch(const cv::Exception&) {
+        LOG(Warning, Detection, "Cannot parse the detector parameters in {}", fileName);
+        return false;
+    }
+
+    FileNode root = fs.root();
+    readField(root, "adaptiveThreshWinSizeMin", parameters->adaptiveThreshWinSizeMin);
+    readField(root, "adaptiveThreshWinSizeMax", parameters->adaptiveThreshWinSizeMax);
+    readField(root, "adaptiveThreshWinSizeStep", parameters->adaptiveThreshWinSizeStep);
+    readField(root, "adaptiveThreshConstant", parameters->adaptiveThreshConstant);
+    readField(root, "minMarkerPerimeterRate", parameters->minMarkerPerimeterRate);
+    readField(root, "maxMarkerPerimeterRate", parameters->maxMarkerPerimeterRate);
+    readField(root, "polygonalApproxAccuracyRate", parameters->polygonalApproxAccuracyRate);
+    readField(root, "minCornerDistanceRate", parameters->minCornerDistanceRate);
+    readField(root, "minDistanceToBorder", parameters->minDistanceToBorder);
+    readField(root, "minMarkerDistanceRate", parameters->minMarkerDistanceRate);
+    readField(root, "cornerRefinementMethod", parameters->cornerRefinementMethod);
+    readField(root, "cornerRefinementWinSize", parameters->cornerRefinementWinSize);
+    readField(root, "cornerRefinementMaxIterations", parameters->cornerRefinementMaxIterations);
+    readField(root, "cornerRefinementMinAccuracy", parameters->cornerRefinementMinAccuracy);
+    readField(root, "markerBorderBits", parameters->markerBorderBits);
+    readField(root, "perspectiveRemovePixelPerCell", parameters->perspectiveRemovePixelPerCell);
+    readField(root, "perspectiveRemoveIgnoredMarginPerCell", parameters->perspectiveRemoveIgnoredMarginPerCell);
+    readField(root, "maxErroneousBitsInBorderRate", parameters->maxErroneousBitsInBorderRate);
+    readField(root, "minOtsuStdDev", parameters->minOtsuStdDev);
+    readField(root, "errorCorrectionRate", parameters->errorCorrectionRate);
+
+    int detect_inverted = parameters->detectInvertedMarker;
+    readField(root, "detectInvertedMarker", detect_inverted);
+    parameters->detectInvertedMarker = detect_inverted != 0;
+    return true;
+}
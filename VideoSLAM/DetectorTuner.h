@@ -0,0 +1,53 @@
+#ifndef DETECTOR_TUNER_H
+#define DETECTOR_TUNER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/aruco.hpp>
+
+
+// speed and recall of a set of detector parameters, measured on the sample frames
+struct TuningResult {
+    cv::Ptr<cv::aruco::DetectorParameters> parameters;
+    double ms_per_frame = 0;            // mean detection time on a single thread
+    double recall = 0;                  // fraction of the reference detections that were found
+    int false_detections = 0;           // detections of markers, that the reference run did not find
+    double corner_error = 0;            // mean distance of the found corners to the reference corners, in pixels
+};
+
+/// <sumary>
+/// Searches the marker detection parameters for the best trade-off between detection time and recall.
+/// Candidate parameters are run on a sample of frames and compared against a reference run with slow, thorough parameters.
+/// </sumary>
+class DetectorTuner {
+public:
+    // attributes
+    bool use_fast_detector;             // measure FastArucoDetector instead of aruco::detectMarkers, as the tracker does
+
+    // constructors & deconstructors
+    DetectorTuner(const std::vector<cv::Mat>& frames, bool use_fast_detector);
+    virtual ~DetectorTuner();
+
+    // methods
+    void setReference(cv::Ptr<cv::aruco::DetectorParameters> parameters);
+    int getReferenceCount() const { return reference_count; }
+    std::vector<TuningResult> evaluate(const std::vector<cv::Ptr<cv::aruco::DetectorParameters>>& candidates) const;
+
+    static cv::Ptr<cv::aruco::DetectorParameters> referenceParameters();
+    static std::vector<cv::Ptr<cv::aruco::DetectorParameters>> sampleCandidates(int count, uint64_t seed);
+    static std::vector<TuningResult> paretoFrontier(std::vector<TuningResult> results);
+
+private:
+    std::vector<cv::Mat> frames;
+    std::vector<std::vector<int>> reference_ids;
+    std::vector<std::vector<std::vector<cv::Point2f>>> reference_corners;
+    int reference_count;
+
+    TuningResult measure(cv::Ptr<cv::aruco::DetectorParameters> parameters) const;
+};
+
+bool saveDetectorParameters(std::string fileName, const cv::Ptr<cv::aruco::DetectorParameters>& parameters);
+bool loadDetectorParameters(std::string fileName, cv::Ptr<cv::aruco::DetectorParameters>& parameters);
+
+#endif
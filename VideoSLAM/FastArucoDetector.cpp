@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "FastArucoDetector.h"
+
+using namespace std;
+using namespace cv;
+
+/// <sumary>
+/// Finds the marker candidates over all adaptive threshold windows of the parameters. Contours are rejected
+/// by their length before any polygon approximation, since most of them belong to clutter.
+/// </sumary>
+/// <param name="gray">Grayscale image</param>
+/// <param name="parameters">Detector parameters, same meaning as in aruco::detectMarkers</param>
+/// <param name="thresholded">Buffer for the thresholded image</param>
+/// <param name="contours">Buffer for the contours</param>
+/// <param name="approx">Buffer for the polygon approximation of a contour</param>
+/// <param name="candidates">Clockwise ordered corners of the candidates, followed by the unused candidates of earlier calls</param>
+/// <returns>Number of candidates found</returns>
+size_t findMarkerCandidates(const Mat& gray, const Ptr<aruco::DetectorParameters>& parameters, Mat& thresholded,
+                            vector<vector<Point>>& contours, vector<Point>& approx, vector<vector<Point2f>>& candidates) {
+    size_t num_candidates = 0;
+
+    int max_dimension = max(gray.cols, gray.rows);
+    size_t min_perimeter = (size_t) (parameters->minMarkerPerimeterRate * max_dimension);
+    size_t max_perimeter = (size_t) (parameters->maxMarkerPerimeterRate * max_dimension);
+
+    for(int win_size = parameters->adaptiveThreshWinSizeMin; win_size <= parameters->adaptiveThreshWinSizeMax; win_size += parameters->adaptiveThreshWinSizeStep) {
+        int odd_win_size = win_size % 2 == 1 ? win_size : win_size + 1;
+        {
+            // the filter and contour buffers of OpenCV are allocated on every call
+            UncountedAllocations library;
+            adaptiveThreshold(gray, thresholded, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, odd_win_size, parameters->adaptiveThreshConstant);
+            findContours(thresholded, contours, RETR_LIST, CHAIN_APPROX_NONE);
+        }
+
+        for(size_t i = 0; i < contours.size(); i++) {
+            // cheapest checks first
+            if(contours[i].size() < min_perimeter || contours[i].size() > max_perimeter) continue;
+
+            {
+                UncountedAllocations library;
+                approxPolyDP(contours[i], approx, double(contours[i].size()) * parameters->polygonalApproxAccuracyRate, true);
+            }
+            if(approx.size() != 4 || !isContourConvex(approx)) continue;
+
+            // corners too close to each other
+            double min_side_squared = DBL_MAX;
+            for(int j = 0; j < 4; j++) {
+                Point side = approx[j] - approx[(j + 1) % 4];
+                min_side_squared = min(min_side_squared, double(side.dot(side)));
+            }
+            double min_corner_distance = contours[i].size() * parameters->minCornerDistanceRate;
+            if(min_side_squared < min_corner_distance * min_corner_distance) continue;
+
+            // corners too close to the image border
+            bool too_near_border = false;
+            for(int j = 0; j < 4; j++) {
+                if(approx[j].x < parameters->minDistanceToBorder || approx[j].y < parameters->minDistanceToBorder
+                   || approx[j].x > gray.cols - 1 - parameters->minDistanceToBorder || approx[j].y > gray.rows - 1 - parameters->minDistanceToBorder) {
+                    too_near_border = true;
+                }
+            }
+            if(too_near_border) continue;
+
+            // the candidates of earlier calls are overwritten, keeping their memory
+            if(num_candidates == candidates.size()) candidates.emplace_back(4);
+            vector<Point2f>& candidate = candidates[num_candidates++];
+            for(int j = 0; j < 4; j++) {
+                candidate[j] = Point2f((float) approx[j].x, (float) approx[j].y);
+            }
+
+            // clockwise order in image coordinates
+            Point2f v1 = candidate[1] - candidate[0];
+            Point2f v2 = candidate[2] - candidate[0];
+            if(v1.x * v2.y - v1.y * v2.x < 0) swap(candidate[1], candidate[3]);
+        }
+
+        if(parameters->adaptiveThreshWinSizeStep <= 0) break;
+    }
+    return num_candidates;
+}
@@ -0,0 +1,285 @@
+#ifndef FAST_ARUCO_DETECTOR_H
+#define FAST_ARUCO_DETECTOR_H
+
+#include <array>
+#include <algorithm>
+
+
+// finds convex quadrilaterals, that could be markers, the same way aruco::detectMarkers does before identification
+size_t findMarkerCandidates(const cv::Mat& gray, const cv::Ptr<cv::aruco::DetectorParameters>& parameters, cv::Mat& thresholded,
+                            std::vector<std::vector<cv::Point>>& contours, std::vector<cv::Point>& approx, std::vector<std::vector<cv::Point2f>>& candidates);
+
+// compile time information about the predefined 4x4 to 7x7 dictionaries
+constexpr int dictionaryMarkerSize(int name) { return 4 + name / 4; }
+constexpr int dictionaryNumMarkers(int name) { return name % 4 == 0 ? 50 : name % 4 == 1 ? 100 : name % 4 == 2 ? 250 : 1000; }
+constexpr size_t nextPowerOfTwo(size_t value, size_t power = 1) { return power >= value ? power : nextPowerOfTwo(value, power * 2); }
+
+/// <sumary>
+/// Marker detector specialized for one predefined dictionary. Candidates are sampled on a fixed grid of cells,
+/// rejected by their border and identified with a single lookup in a table, that holds all four rotations of every code.
+/// Produces the same corners and IDs as aruco::detectMarkers, without corner refinement other than subpixel.
+/// </sumary>
+template<int DICTIONARY>
+class FastArucoDetector {
+public:
+    static_assert(DICTIONARY >= cv::aruco::DICT_4X4_50 && DICTIONARY <= cv::aruco::DICT_7X7_1000, "Only the predefined 4x4 to 7x7 dictionaries are supported");
+
+    static const int MARKER_SIZE = dictionaryMarkerSize(DICTIONARY);
+    static const int NUM_MARKERS = dictionaryNumMarkers(DICTIONARY);
+    static const int CELLS = MARKER_SIZE + 2;                   // marker bits and the black border
+    static const int SAMPLES = 2;                               // samples per cell side
+
+    FastArucoDetector(cv::Ptr<cv::aruco::DetectorParameters> parameters) {
+        this->parameters = parameters;
+        codeTable(correctsBits());
+    }
+
+    virtual ~FastArucoDetector() = default;
+
+    /// <sumary>
+    /// Detects the markers of the dictionary in the image. The outputs are overwritten in place, so an image with
+    /// as many markers and candidates as the last one is detected without allocating.
+    /// </sumary>
+    /// <param name="image">Grayscale or BGR image</param>
+    /// <param name="corners">Corners of the detected markers, clockwise from the marker's top left corner</param>
+    /// <param name="ids">IDs of the detected markers</param>
+    /// <param name="rejects">Candidates that are not markers of the dictionary</param>
+    void detectMarkers(const cv::Mat& image, std::vector<std::vector<cv::Point2f>>& corners, std::vector<int>& ids,
+                       std::vector<std::vector<cv::Point2f>>& rejects) {
+        ids.clear();
+        size_t num_rejects = 0;
+
+        if(image.channels() == 3) {
+            UncountedAllocations library;
+            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        } else {
+            gray = image;
+        }
+
+        size_t num_candidates = findMarkerCandidates(gray, parameters, thresholded, contours, approx, candidates);
+
+        int max_border_errors = int(MARKER_SIZE * MARKER_SIZE * parameters->maxErroneousBitsInBorderRate);
+        const CodeTable& table = codeTable(correctsBits());
+        for(size_t i = 0; i < num_candidates; i++) {
+            int id, rotation;
+            if(!identify(candidates[i], max_border_errors, table, id, rotation)) {
+                setElement(rejects, num_rejects++, candidates[i]);
+                continue;
+            }
+
+            std::rotate(candidates[i].begin(), candidates[i].begin() + rotation, candidates[i].end());
+
+            // the same marker is found with several threshold windows, keep the largest one
+            double perimeter = cv::arcLength(candidates[i], true);
+            cv::Point2f center = (candidates[i][0] + candidates[i][1] + candidates[i][2] + candidates[i][3]) * 0.25f;
+            bool duplicate = false;
+            for(size_t j = 0; j < ids.size() && !duplicate; j++) {
+                cv::Point2f other_center = (corners[j][0] + corners[j][1] + corners[j][2] + corners[j][3]) * 0.25f;
+                if(ids[j] != id || cv::norm(center - other_center) > perimeter / 4) continue;
+
+                duplicate = true;
+                if(perimeter > cv::arcLength(corners[j], true)) corners[j] = candidates[i];
+            }
+            if(duplicate) continue;
+
+            setElement(corners, ids.size(), candidates[i]);
+            ids.push_back(id);
+        }
+        corners.resize(ids.size());
+        rejects.resize(num_rejects);
+
+        if(parameters->cornerRefinementMethod == cv::aruco::CORNER_REFINE_SUBPIX) {
+            UncountedAllocations library;
+            for(size_t i = 0; i < corners.size(); i++) {
+                cv::cornerSubPix(gray, corners[i], cv::Size(parameters->cornerRefinementWinSize, parameters->cornerRefinementWinSize), cv::Size(-1, -1),
+                                 cv::TermCriteria(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS, parameters->cornerRefinementMaxIterations, parameters->cornerRefinementMinAccuracy));
+            }
+        }
+    }
+
+private:
+    // one rotation of a code, or a code with a single corrected bit
+    struct CodeEntry {
+        uint64_t code = 0;
+        int16_t id = -1;                // -1 for an empty slot, -2 for a code shared by several markers
+        int8_t rotation = 0;
+        bool exact = false;
+    };
+
+    static const size_t TABLE_SIZE = nextPowerOfTwo(2 * NUM_MARKERS * 4 * (1 + MARKER_SIZE * MARKER_SIZE));
+    typedef std::vector<CodeEntry> CodeTable;
+
+    cv::Ptr<cv::aruco::DetectorParameters> parameters;
+    cv::Mat gray, thresholded;
+    std::vector<std::vector<cv::Point>> contours;
+    std::vector<cv::Point> approx;
+    std::vector<std::vector<cv::Point2f>> candidates;
+
+    // overwrites an element of an output vector, so the memory of the element is reused
+    static void setElement(std::vector<std::vector<cv::Point2f>>& elements, size_t index, const std::vector<cv::Point2f>& value) {
+        if(index < elements.size()) elements[index] = value;
+        else elements.push_back(value);
+    }
+
+    static size_t slot(uint64_t code) {
+        return (size_t) ((code * 0x9E3779B97F4A7C15ULL) >> 32) & (TABLE_SIZE - 1);
+    }
+
+    static void insert(CodeTable& table, uint64_t code, int id, int rotation, bool exact) {
+        size_t i = slot(code);
+        while(table[i].id != -1 && table[i].code != code) i = (i + 1) & (TABLE_SIZE - 1);
+
+        if(table[i].id == -1) {
+            table[i].code = code;
+            table[i].id = (int16_t) id;
+            table[i].rotation = (int8_t) rotation;
+            table[i].exact = exact;
+        } else if(!table[i].exact && (table[i].id != id || table[i].rotation != rotation)) {
+            // exact codes always win, ambiguous corrections are not accepted
+            table[i].id = -2;
+        }
+    }
+
+    static int maxCorrectionBits() {
+        static const int bits = cv::aruco::getPredefinedDictionary(DICTIONARY)->maxCorrectionBits;
+        return bits;
+    }
+
+    // single bit errors are corrected when aruco::detectMarkers would correct them with the current errorCorrectionRate
+    bool correctsBits() const {
+        return int(maxCorrectionBits() * parameters->errorCorrectionRate) >= 1;
+    }
+
+    // built once for each setting, on first use
+    static const CodeTable& codeTable(bool correct_bits) {
+        if(correct_bits) {
+            static const CodeTable corrected = buildCodeTable(true);
+            return corrected;
+        }
+        static const CodeTable exact = buildCodeTable(false);
+        return exact;
+    }
+
+    static CodeTable buildCodeTable(bool correct_bits) {
+        CodeTable table(TABLE_SIZE);
+        cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(DICTIONARY);
+
+        // sampled bits equal to the code rotated clockwise k times mean, that the marker's top left corner is corner k of the candidate
+        std::vector<CodeEntry> codes;
+        for(int id = 0; id < NUM_MARKERS; id++) {
+            cv::Mat bits = cv::aruco::Dictionary::getBitsFromByteList(dictionary->bytesList.rowRange(id, id + 1), MARKER_SIZE);
+            for(int rotation = 0; rotation < 4; rotation++) {
+                CodeEntry entry;
+                entry.id = (int16_t) id;
+                entry.rotation = (int8_t) rotation;
+                for(int r = 0; r < MARKER_SIZE; r++) {
+                    for(int c = 0; c < MARKER_SIZE; c++) {
+                        entry.code = (entry.code << 1) | (bits.at<uchar>(r, c) ? 1 : 0);
+                    }
+                }
+                insert(table, entry.code, id, rotation, true);
+                codes.push_back(entry);
+
+                cv::Mat rotated;
+                cv::rotate(bits, rotated, cv::ROTATE_90_CLOCKWISE);
+                bits = rotated;
+            }
+        }
+
+        if(correct_bits) {
+            for(size_t i = 0; i < codes.size(); i++) {
+                for(int bit = 0; bit < MARKER_SIZE * MARKER_SIZE; bit++) {
+                    insert(table, codes[i].code ^ (1ULL << bit), codes[i].id, codes[i].rotation, false);
+                }
+            }
+        }
+        return table;
+    }
+
+    /// <sumary>
+    /// Samples the candidate on a CELLS x CELLS grid and looks its code up.
+    /// </sumary>
+    bool identify(const std::vector<cv::Point2f>& quad, int max_border_errors, const CodeTable& table, int& id, int& rotation) const {
+        // homography of the unit square onto the quad
+        double x0 = quad[0].x, y0 = quad[0].y, x1 = quad[1].x, y1 = quad[1].y;
+        double x2 = quad[2].x, y2 = quad[2].y, x3 = quad[3].x, y3 = quad[3].y;
+        double dx1 = x1 - x2, dx2 = x3 - x2, dx3 = x0 - x1 + x2 - x3;
+        double dy1 = y1 - y2, dy2 = y3 - y2, dy3 = y0 - y1 + y2 - y3;
+        double det = dx1 * dy2 - dx2 * dy1;
+        if(det == 0) return false;
+        double g = (dx3 * dy2 - dx2 * dy3) / det, h = (dx1 * dy3 - dx3 * dy1) / det;
+        double a = x1 - x0 + g * x1, b = x3 - x0 + h * x3, c = x0;
+        double d = y1 - y0 + g * y1, e = y3 - y0 + h * y3, f = y0;
+
+        // mean intensity of the inner part of every cell
+        std::array<int, CELLS * CELLS> cells;
+        int min_value = 255, max_value = 0;
+        for(int r = 0; r < CELLS; r++) {
+            for(int col = 0; col < CELLS; col++) {
+                int sum = 0;
+                for(int sr = 0; sr < SAMPLES; sr++) {
+                    for(int sc = 0; sc < SAMPLES; sc++) {
+                        double u = (col + (sc + 1.0) / (SAMPLES + 1)) / CELLS;
+                        double v = (r + (sr + 1.0) / (SAMPLES + 1)) / CELLS;
+                        double w = g * u + h * v + 1;
+                        int x = cvRound((a * u + b * v + c) / w);
+                        int y = cvRound((d * u + e * v + f) / w);
+                        x = std::min(std::max(x, 0), gray.cols - 1);
+                        y = std::min(std::max(y, 0), gray.rows - 1);
+                        sum += gray.ptr<uchar>(y)[x];
+                    }
+                }
+                int value = sum / (SAMPLES * SAMPLES);
+                cells[r * CELLS + col] = value;
+                min_value = std::min(min_value, value);
+                max_value = std::max(max_value, value);
+            }
+        }
+
+        // a marker always has black and white cells
+        if(max_value - min_value < 2 * parameters->minOtsuStdDev) return false;
+
+        // two class threshold
+        int threshold = (min_value + max_value) / 2;
+        int sum_low = 0, sum_high = 0, num_low = 0;
+        for(int i = 0; i < CELLS * CELLS; i++) {
+            if(cells[i] < threshold) {
+                sum_low += cells[i];
+                num_low++;
+            } else {
+                sum_high += cells[i];
+            }
+        }
+        if(num_low == 0 || num_low == CELLS * CELLS) return false;
+        threshold = (sum_low / num_low + sum_high / (CELLS * CELLS - num_low)) / 2;
+
+        // the border has to be black
+        int border_errors = 0;
+        for(int k = 0; k < CELLS; k++) {
+            border_errors += (cells[k] >= threshold) + (cells[(CELLS - 1) * CELLS + k] >= threshold);
+            if(k > 0 && k < CELLS - 1) {
+                border_errors += (cells[k * CELLS] >= threshold) + (cells[k * CELLS + CELLS - 1] >= threshold);
+            }
+        }
+        if(border_errors > max_border_errors) return false;
+
+        uint64_t code = 0;
+        for(int r = 1; r <= MARKER_SIZE; r++) {
+            for(int col = 1; col <= MARKER_SIZE; col++) {
+                code = (code << 1) | (cells[r * CELLS + col] >= threshold ? 1 : 0);
+            }
+        }
+
+        for(size_t i = slot(code); table[i].id != -1; i = (i + 1) & (TABLE_SIZE - 1)) {
+            if(table[i].code != code) continue;
+            if(table[i].id < 0) return false;
+
+            id = table[i].id;
+            rotation = table[i].rotation;
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif
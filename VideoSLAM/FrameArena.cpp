@@ -0,0 +1,97 @@
+#include "stdafx.h"
+#include "FrameArena.h"
+
+using namespace std;
+
+FrameArena::FrameArena(size_t initial_size) : block(new char[initial_size]) {
+    this->capacity = initial_size;
+    this->used = 0;
+    this->overflow_size = 0;
+}
+
+FrameArena::~FrameArena() = default;
+
+/// <sumary>
+/// Takes memory from the arena. It stays valid until the next reset.
+/// </sumary>
+/// <param name="alignment">Power of two</param>
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+    size_t start = (used + alignment - 1) & ~(alignment - 1);
+    if(start + bytes <= capacity) {
+        used = start + bytes;
+        return block.get() + start;
+    }
+
+    // too small for this frame, the memory is taken from the heap until the next reset
+    overflow.push_back(unique_ptr<char[]>(new char[bytes + alignment]));
+    overflow_size += bytes + alignment;
+    char* memory = overflow.back().get();
+    return memory + ((alignment - (size_t) memory % alignment) % alignment);
+}
+
+/// <sumary>
+/// Frees everything allocated since the last reset. If the last frame did not fit, the arena grows to fit it.
+/// </sumary>
+void FrameArena::reset() {
+    if(!overflow.empty()) {
+        capacity = max(2 * capacity, capacity + overflow_size);
+        block.reset(new char[capacity]);
+        overflow.clear();
+        overflow_size = 0;
+    }
+    used = 0;
+}
+
+#ifdef COUNT_ALLOCATIONS
+static thread_local uint64_t thread_allocations = 0;
+static thread_local int uncounted_scopes = 0;
+
+uint64_t threadAllocationCount() {
+    return thread_allocations;
+}
+
+UncountedAllocations::UncountedAllocations() {
+    uncounted_scopes++;
+}
+
+UncountedAllocations::~UncountedAllocations() {
+    uncounted_scopes--;
+}
+
+// every allocation of the program goes through these
+void* operator new(size_t size) {
+    if(uncounted_scopes == 0) thread_allocations++;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if(memory == nullptr) throw bad_alloc();
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    if(uncounted_scopes == 0) thread_allocations++;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return operator new(size, nothrow);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t size) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t size) noexcept {
+    free(memory);
+}
+#endif
@@ -0,0 +1,83 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// counts the heap allocations of every thread, to check that the tracker does not allocate once it is warmed up.
+// Debug builds always count them.
+// #define COUNT_ALLOCATIONS
+#if defined(_DEBUG) && !defined(COUNT_ALLOCATIONS)
+#define COUNT_ALLOCATIONS
+#endif
+
+
+/// <sumary>
+/// Memory for the temporary data of a single frame. Allocations only move a pointer and are all freed at once,
+/// when the arena is reset before the next frame. A frame that does not fit makes the arena grow at the next reset,
+/// so after the first frames no memory is allocated from the heap.
+/// </sumary>
+class FrameArena {
+public:
+    // constructors & deconstructors
+    FrameArena(size_t initial_size = 64 * 1024);
+    virtual ~FrameArena();
+
+    // methods
+    void* allocate(size_t bytes, size_t alignment);
+    void reset();
+    size_t getCapacity() const { return capacity; }
+    size_t getUsed() const { return used; }
+
+private:
+    std::unique_ptr<char[]> block;
+    size_t capacity;
+    size_t used;
+
+    // allocations that did not fit into the block, freed on reset
+    std::vector<std::unique_ptr<char[]>> overflow;
+    size_t overflow_size;
+};
+
+// STL allocator, that takes the memory from a FrameArena
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    FrameArena* arena;
+
+    ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return (T*) arena->allocate(n * sizeof(T), alignof(T)); }
+    void deallocate(T* pointer, size_t n) {}   // freed with the arena
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#ifdef COUNT_ALLOCATIONS
+// number of heap allocations made by the calling thread so far, outside of UncountedAllocations scopes
+uint64_t threadAllocationCount();
+#endif
+
+// allocations of the calling thread are not counted while it exists. For calls into libraries, whose temporaries cannot be kept between frames.
+class UncountedAllocations {
+public:
+#ifdef COUNT_ALLOCATIONS
+    UncountedAllocations();
+    ~UncountedAllocations();
+#else
+    UncountedAllocations() {}
+#endif
+};
+
+#endif
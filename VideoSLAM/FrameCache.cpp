@@ -0,0 +1,326 @@
+#include "stdafx.h"
+#include "FrameCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace cv;
+namespace fs = experimental::filesystem;
+
+static const uint32_t FRAME_CACHE_MAGIC = 0x43464C56;  // "VLFC"
+static const uint32_t FRAME_CACHE_VERSION = 1;
+static const char FRAME_CACHE_EXTENSION[] = ".frames";
+
+// frame data starts at a page boundary after the header and the slot flags
+static const size_t CACHE_PAGE_SIZE = 4096;
+// bytes read from either end of the video for its identity, hashing whole videos would take longer than decoding them
+static const size_t IDENTITY_BYTES = 1 << 20;
+
+struct FrameCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;                       // video identity and settings
+    int32_t width;
+    int32_t height;
+    int32_t type;
+    int32_t slot_count;
+    uint64_t slot_size;
+    uint64_t data_offset;
+};
+
+// 64-bit FNV-1a, continued from the given hash
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const uchar* bytes = (const uchar*) data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// hash of the video's size and of its first and last bytes
+static bool videoIdentity(string video_path, uint64_t& hash) {
+    ifstream inStream(video_path, ios::binary | ios::ate);
+    if(!inStream) return false;
+
+    uint64_t size = (uint64_t) inStream.tellg();
+    size_t part = (size_t) min<uint64_t>(size, IDENTITY_BYTES);
+    vector<char> bytes(part);
+    hash = hashBytes(14695981039346656037ULL, &size, sizeof(size));
+
+    inStream.seekg(0);
+    if(!inStream.read(bytes.data(), part)) return false;
+    hash = hashBytes(hash, bytes.data(), part);
+
+    inStream.seekg(size - part);
+    if(!inStream.read(bytes.data(), part)) return false;
+    hash = hashBytes(hash, bytes.data(), part);
+    return true;
+}
+
+/// <sumary>
+/// Creates a closed cache.
+/// </sumary>
+/// <param name="directory">Directory of the cache files, created when the first video is cached</param>
+/// <param name="max_bytes">Size cap of all cache files together</param>
+FrameCache::FrameCache(string directory, uint64_t max_bytes) {
+    this->directory = directory;
+    this->max_bytes = max_bytes;
+    this->memory = nullptr;
+    this->mapped_size = 0;
+    this->header = nullptr;
+    this->slot_flags = nullptr;
+    this->slot_data = nullptr;
+    this->file_handle = nullptr;
+    this->mapping_handle = nullptr;
+}
+
+FrameCache::~FrameCache() {
+    close();
+}
+
+/// <sumary>
+/// Opens the cache file of a video, or creates it when the video has not been cached with these settings yet.
+/// </sumary>
+/// <param name="video_path">Path to the video</param>
+/// <param name="cap">The opened video, its frame count and size decide the size of the cache file</param>
+/// <param name="settings">How the frames are stored</param>
+/// <returns>False if the video cannot be cached, the frames then have to be decoded</returns>
+bool FrameCache::open(string video_path, VideoCapture& cap, const FrameCacheSettings& settings) {
+    close();
+    this->settings = settings;
+
+    int frame_count = (int) cap.get(CAP_PROP_FRAME_COUNT);
+    Size video_size((int) cap.get(CAP_PROP_FRAME_WIDTH), (int) cap.get(CAP_PROP_FRAME_HEIGHT));
+    uint64_t key;
+    if(frame_count <= 0 || video_size.area() <= 0 || settings.stride < 1 || settings.scale <= 0 || !videoIdentity(video_path, key)) {
+        LOG(Warning, Main, "Frames of {} cannot be cached", video_path);
+        return false;
+    }
+    key = hashBytes(key, &settings.grayscale, sizeof(settings.grayscale));
+    key = hashBytes(key, &settings.scale, sizeof(settings.scale));
+    key = hashBytes(key, &settings.stride, sizeof(settings.stride));
+
+    // layout of the file
+    FrameCacheHeader layout;
+    layout.magic = FRAME_CACHE_MAGIC;
+    layout.version = FRAME_CACHE_VERSION;
+    layout.key = key;
+    layout.width = cvRound(video_size.width * settings.scale);
+    layout.height = cvRound(video_size.height * settings.scale);
+    layout.type = settings.grayscale ? CV_8UC1 : CV_8UC3;
+    layout.slot_count = (frame_count + settings.stride - 1) / settings.stride;
+    layout.slot_size = (uint64_t) layout.width * layout.height * CV_ELEM_SIZE(layout.type);
+    layout.data_offset = (sizeof(FrameCacheHeader) + layout.slot_count + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE * CACHE_PAGE_SIZE;
+    uint64_t size = layout.data_offset + layout.slot_count * layout.slot_size;
+
+    string path = directory + format("%016llx", (unsigned long long) key) + FRAME_CACHE_EXTENSION;
+    error_code error;
+    bool cached = fs::exists(path, error) && fs::file_size(path, error) == size;
+    if(!cached) {
+        if(size > max_bytes) {
+            LOG(Warning, Main, "Frames of {} need {} MB, more than the whole frame cache", video_path, size >> 20);
+            return false;
+        }
+        fs::create_directories(directory, error);
+        if(!makeRoom(size, path)) {
+            LOG(Warning, Main, "Could not free {} MB in the frame cache for {}", size >> 20, video_path);
+            return false;
+        }
+    }
+    if(!mapFile(path, (size_t) size)) {
+        LOG(Warning, Main, "Could not map the frame cache file {}", path);
+        return false;
+    }
+
+    FrameCacheHeader* mapped = (FrameCacheHeader*) memory;
+    slot_flags = (uchar*) memory + sizeof(FrameCacheHeader);
+    if(memcmp(mapped, &layout, sizeof(FrameCacheHeader)) != 0) {
+        // a new file, or one written by an interrupted or older run
+        mapped->magic = 0;
+        memset(slot_flags, 0, layout.slot_count);
+        layout.magic = 0;
+        memcpy(mapped, &layout, sizeof(FrameCacheHeader));
+        atomic_thread_fence(memory_order_release);
+        mapped->magic = FRAME_CACHE_MAGIC;
+    }
+    header = mapped;
+    slot_data = (uchar*) memory + header->data_offset;
+
+    // the last use of a file is its modification time, which eviction goes by
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    LOG(Info, Main, "Frame cache {}: {} of {} frames cached", path, getCachedCount(), header->slot_count);
+    return true;
+}
+
+void FrameCache::close() {
+    if(memory == nullptr) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(memory);
+    CloseHandle((HANDLE) mapping_handle);
+    CloseHandle((HANDLE) file_handle);
+#else
+    munmap(memory, mapped_size);
+#endif
+    memory = nullptr;
+    mapped_size = 0;
+    header = nullptr;
+    slot_flags = nullptr;
+    slot_data = nullptr;
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+}
+
+/// <sumary>
+/// Reads a frame stored by this or an earlier run. The frame is not copied, it points into the mapped file.
+/// </sumary>
+/// <param name="frame_num">Number of the frame in the video</param>
+/// <param name="frame">The frame, valid until the cache is closed and must not be written to</param>
+/// <returns>False if the frame is not in the cache</returns>
+bool FrameCache::read(int frame_num, Mat& frame) const {
+    int slot = slotOf(frame_num);
+    if(slot < 0 || slot_flags[slot] == 0) return false;
+    atomic_thread_fence(memory_order_acquire);
+
+    frame = Mat(header->height, header->width, header->type, slot_data + slot * header->slot_size);
+    return true;
+}
+
+/// <sumary>
+/// Converts a decoded frame as the settings say and stores it. Frames the cache has no slot for are only converted,
+/// so the caller gets the same kind of frame either way.
+/// </sumary>
+/// <param name="frame_num">Number of the frame in the video</param>
+/// <param name="decoded">Frame as it was decoded</param>
+/// <param name="frame">The converted frame, pointing into the mapped file if it was stored</param>
+void FrameCache::store(int frame_num, const Mat& decoded, Mat& frame) {
+    int slot = slotOf(frame_num);
+    bool fits = slot >= 0 && cvRound(decoded.cols * settings.scale) == header->width && cvRound(decoded.rows * settings.scale) == header->height
+                && decoded.type() == CV_8UC3;
+    if(!fits) {
+        // a new buffer, the frame might still point into the cache
+        frame.release();
+        convert(decoded, frame);
+        return;
+    }
+
+    frame = Mat(header->height, header->width, header->type, slot_data + slot * header->slot_size);
+    convert(decoded, frame);
+    atomic_thread_fence(memory_order_release);
+    slot_flags[slot] = 1;
+}
+
+/// <sumary>
+/// Converts a decoded frame as the settings say.
+/// </sumary>
+/// <param name="decoded">Frame as it was decoded</param>
+/// <param name="frame">The converted frame, written in place if it already has the right size and type</param>
+void FrameCache::convert(const Mat& decoded, Mat& frame) const {
+    Size size(cvRound(decoded.cols * settings.scale), cvRound(decoded.rows * settings.scale));
+    bool to_gray = settings.grayscale && decoded.channels() == 3;
+    if(size == decoded.size()) {
+        if(to_gray) cvtColor(decoded, frame, COLOR_BGR2GRAY);
+        else decoded.copyTo(frame);
+    } else if(to_gray) {
+        // the small copy is converted, not the whole frame
+        Mat resized;
+        resize(decoded, resized, size, 0, 0, INTER_AREA);
+        cvtColor(resized, frame, COLOR_BGR2GRAY);
+    } else {
+        resize(decoded, frame, size, 0, 0, INTER_AREA);
+    }
+}
+
+int FrameCache::getCachedCount() const {
+    if(header == nullptr) return 0;
+    return (int) count(slot_flags, slot_flags + header->slot_count, 1);
+}
+
+// slot of the frame, -1 if the cache has none for it
+int FrameCache::slotOf(int frame_num) const {
+    if(header == nullptr || frame_num < 0 || frame_num % settings.stride != 0) return -1;
+    int slot = frame_num / settings.stride;
+    return slot < header->slot_count ? slot : -1;
+}
+
+// maps the whole file for reading and writing, it is created or resized as needed
+bool FrameCache::mapFile(string path, size_t size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    file_size.QuadPart = (LONGLONG) size;
+    if(!SetFilePointerEx(file, file_size, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, file_size.HighPart, file_size.LowPart, nullptr);
+    if(mapping != nullptr) memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(memory == nullptr) {
+        if(mapping != nullptr) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_handle = file;
+    mapping_handle = mapping;
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0) return false;
+    if(ftruncate(fd, (off_t) size) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(memory == MAP_FAILED) memory = nullptr;
+    }
+    ::close(fd);
+    if(memory == nullptr) return false;
+#endif
+
+    mapped_size = size;
+    return true;
+}
+
+// evicts the least recently used cache files, until a file of the given size fits under the cap
+bool FrameCache::makeRoom(uint64_t bytes, string keep_path) {
+    struct CacheFile {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type last_used;
+    };
+
+    vector<CacheFile> files;
+    uint64_t total = 0;
+    error_code error;
+    for(const fs::directory_entry& entry : fs::directory_iterator(directory, error)) {
+        if(entry.path().extension() != FRAME_CACHE_EXTENSION || entry.path().filename() == fs::path(keep_path).filename()) continue;
+
+        CacheFile file;
+        file.path = entry.path();
+        file.size = fs::file_size(file.path, error);
+        file.last_used = fs::last_write_time(file.path, error);
+        if(error) continue;
+        files.push_back(file);
+        total += file.size;
+    }
+
+    sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.last_used < b.last_used; });
+    for(size_t i = 0; i < files.size() && total + bytes > max_bytes; i++) {
+        // files another process has mapped cannot be removed on Windows, they are skipped
+        if(!fs::remove(files[i].path, error)) continue;
+        total -= files[i].size;
+        LOG(Info, Main, "Evicted {} from the frame cache, {} MB", files[i].path.string(), files[i].size >> 20);
+    }
+    return total + bytes <= max_bytes;
+}
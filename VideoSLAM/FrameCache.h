@@ -0,0 +1,59 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+
+// how the frames are kept in the cache, a video cached with other settings is a different cache entry
+struct FrameCacheSettings {
+    bool grayscale = true;              // frames are converted to grayscale before they are stored
+    double scale = 1;                   // size of the stored frames relative to the video
+    int stride = 1;                     // only every stride-th frame of the video is stored
+};
+
+struct FrameCacheHeader;
+
+/// <sumary>
+/// Decoded frames of a video, kept in a memory-mapped file so that later runs over the same video read them
+/// from the page cache instead of decoding them again. Frames are stored as they are decoded by the first run,
+/// every video and settings get a file of their own in the cache directory. The directory is kept under a size cap,
+/// the least recently used files are evicted to make room for a new one.
+/// Frames of different slots can be stored and read by several threads at once.
+/// </sumary>
+class FrameCache {
+public:
+    // constructors & deconstructors
+    FrameCache(std::string directory, uint64_t max_bytes);
+    virtual ~FrameCache();
+
+    // methods
+    bool open(std::string video_path, cv::VideoCapture& cap, const FrameCacheSettings& settings);
+    void close();
+    bool isOpen() const { return header != nullptr; }
+    bool read(int frame_num, cv::Mat& frame) const;
+    void store(int frame_num, const cv::Mat& decoded, cv::Mat& frame);
+    void convert(const cv::Mat& decoded, cv::Mat& frame) const;
+    const FrameCacheSettings& getSettings() const { return settings; }
+    int getCachedCount() const;
+
+private:
+    std::string directory;
+    uint64_t max_bytes;
+    FrameCacheSettings settings;
+
+    // mapped file
+    void* memory;
+    size_t mapped_size;
+    FrameCacheHeader* header;
+    uchar* slot_flags;                  // 1 for the slots holding a frame
+    uchar* slot_data;
+    void* file_handle;
+    void* mapping_handle;
+
+    int slotOf(int frame_num) const;
+    bool mapFile(std::string path, size_t size);
+    bool makeRoom(uint64_t bytes, std::string keep_path);
+};
+
+#endif
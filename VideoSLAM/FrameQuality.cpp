@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "FrameQuality.h"
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+using namespace cv;
+
+// luma at or below and at or above these is under- or overexposed
+static const uchar DARK_LUMA = 5;
+static const uchar BRIGHT_LUMA = 250;
+
+/// <sumary>
+/// Measures the sharpness and exposure of a grayscale image in a single pass over its inner pixels.
+/// The 4-neighbour Laplacian, its square and the luma are accumulated with OpenCV's universal intrinsics,
+/// a whole vector register of pixels at a time.
+/// </sumary>
+/// <param name="gray">8-bit grayscale image, usually a small copy of the frame</param>
+/// <returns>Sharpness and exposure of the image</returns>
+FrameQuality measureFrameQuality(const Mat& gray) {
+    CV_Assert(gray.type() == CV_8UC1);
+    FrameQuality quality;
+    int width = gray.cols, height = gray.rows;
+    if(width < 3 || height < 3) return quality;
+
+    int64_t laplacian_sum = 0, square_sum = 0, luma_sum = 0, clipped_count = 0;
+    for(int y = 1; y < height - 1; y++) {
+        const uchar* above = gray.ptr<uchar>(y - 1);
+        const uchar* row = gray.ptr<uchar>(y);
+        const uchar* below = gray.ptr<uchar>(y + 1);
+        int x = 1;
+
+#if CV_SIMD
+        // sums of a single row fit into 32-bit lanes
+        v_int32 row_laplacian = vx_setzero_s32(), row_square = vx_setzero_s32();
+        v_uint32 row_luma = vx_setzero_u32(), row_clipped = vx_setzero_u32();
+        const v_uint8 dark = vx_setall_u8(DARK_LUMA), bright = vx_setall_u8(BRIGHT_LUMA), one = vx_setall_u8(1);
+        for(; x + v_uint8::nlanes < width; x += v_uint8::nlanes) {
+            v_uint8 center = vx_load(row + x);
+            v_uint16 c0, c1, l0, l1, r0, r1, u0, u1, d0, d1;
+            v_expand(center, c0, c1);
+            v_expand(vx_load(row + x - 1), l0, l1);
+            v_expand(vx_load(row + x + 1), r0, r1);
+            v_expand(vx_load(above + x), u0, u1);
+            v_expand(vx_load(below + x), d0, d1);
+
+            // at most 4 * 255 either way, so 16 bits are enough
+            v_int16 laplacian0 = v_reinterpret_as_s16(l0 + r0 + u0 + d0) - v_reinterpret_as_s16(c0 << 2);
+            v_int16 laplacian1 = v_reinterpret_as_s16(l1 + r1 + u1 + d1) - v_reinterpret_as_s16(c1 << 2);
+            v_int32 s0, s1, s2, s3;
+            v_expand(laplacian0, s0, s1);
+            v_expand(laplacian1, s2, s3);
+            row_laplacian += (s0 + s1) + (s2 + s3);
+            row_square += v_dotprod(laplacian0, laplacian0) + v_dotprod(laplacian1, laplacian1);
+
+            v_uint32 w0, w1, w2, w3;
+            v_expand(c0, w0, w1);
+            v_expand(c1, w2, w3);
+            row_luma += (w0 + w1) + (w2 + w3);
+
+            v_uint16 k0, k1;
+            v_expand(((center <= dark) | (center >= bright)) & one, k0, k1);
+            v_expand(k0 + k1, w0, w1);
+            row_clipped += w0 + w1;
+        }
+        laplacian_sum += v_reduce_sum(row_laplacian);
+        square_sum += v_reduce_sum(row_square);
+        luma_sum += v_reduce_sum(row_luma);
+        clipped_count += v_reduce_sum(row_clipped);
+#endif
+
+        for(; x < width - 1; x++) {
+            int laplacian = row[x - 1] + row[x + 1] + above[x] + below[x] - 4 * row[x];
+            laplacian_sum += laplacian;
+            square_sum += laplacian * laplacian;
+            luma_sum += row[x];
+            if(row[x] <= DARK_LUMA || row[x] >= BRIGHT_LUMA) clipped_count++;
+        }
+    }
+#if CV_SIMD
+    vx_cleanup();
+#endif
+
+    double count = (double) (width - 2) * (height - 2);
+    double mean = laplacian_sum / count;
+    quality.sharpness = square_sum / count - mean * mean;
+    quality.brightness = luma_sum / count;
+    quality.clipped = clipped_count / count;
+    return quality;
+}
+
+FrameQualityFilter::FrameQualityFilter() {
+    this->sample_size = Size(320, 240);
+    this->blur_rate = 0.6;
+    this->min_sharpness = 0;
+    this->max_clipped = 0.5;
+    this->average_sharpness = 0;
+    this->measured = 0;
+}
+
+FrameQualityFilter::~FrameQualityFilter() = default;
+
+/// <sumary>
+/// Measures the quality of a frame on its downsampled luma, the full frame is only read by the resize.
+/// </sumary>
+/// <param name="frame">Grayscale or BGR frame</param>
+/// <returns>Quality of the frame, valid until the next frame is measured</returns>
+const FrameQuality& FrameQualityFilter::measure(const Mat& frame) {
+    resize(frame, small, sample_size, 0, 0, INTER_AREA);
+    if(small.channels() == 3) cvtColor(small, small_gray, COLOR_BGR2GRAY);
+    else small.copyTo(small_gray);
+
+    last_quality = measureFrameQuality(small_gray);
+    return last_quality;
+}
+
+/// <sumary>
+/// Measures the frame and decides, whether it is worth processing. Rejected frames still count into the running average.
+/// </sumary>
+/// <param name="frame">Grayscale or BGR frame, the frames are expected in the order they were recorded</param>
+/// <returns>False if the frame is blurred or badly exposed</returns>
+bool FrameQualityFilter::accept(const Mat& frame) {
+    const FrameQuality& quality = measure(frame);
+    measured++;
+    average_sharpness = measured == 1 ? quality.sharpness : 0.9 * average_sharpness + 0.1 * quality.sharpness;
+
+    if(quality.clipped > max_clipped) return false;
+    return quality.sharpness >= min_sharpness && quality.sharpness >= blur_rate * average_sharpness;
+}
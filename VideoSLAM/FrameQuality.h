@@ -0,0 +1,44 @@
+#ifndef FRAME_QUALITY_H
+#define FRAME_QUALITY_H
+
+
+// sharpness and exposure of a frame, measured on a downsampled luma image
+struct FrameQuality {
+    double sharpness = 0;               // variance of the Laplacian
+    double brightness = 0;              // mean luma, 0 to 255
+    double clipped = 0;                 // fraction of under- and overexposed pixels
+};
+
+FrameQuality measureFrameQuality(const cv::Mat& gray);
+
+/// <sumary>
+/// Cheap check for motion blurred and badly exposed frames, before they are handed to the expensive stages.
+/// Sharpness depends on the scene, so frames are compared against a running average of the recent ones.
+/// </sumary>
+class FrameQualityFilter {
+public:
+    // attributes
+    cv::Size sample_size;               // size of the luma copy the frames are measured on
+    double blur_rate;                   // frames less sharp than this fraction of the running average are blurred
+    double min_sharpness;               // frames less sharp than this are blurred, whatever the average
+    double max_clipped;                 // frames with a larger fraction of under- or overexposed pixels are rejected
+
+    // constructors & deconstructors
+    FrameQualityFilter();
+    virtual ~FrameQualityFilter();
+
+    // methods
+    const FrameQuality& measure(const cv::Mat& frame);
+    bool accept(const cv::Mat& frame);
+    const FrameQuality& getLastQuality() const { return last_quality; }
+    double getAverageSharpness() const { return average_sharpness; }
+    const cv::Mat& getLastSample() const { return small_gray; }
+
+private:
+    cv::Mat small, small_gray;
+    FrameQuality last_quality;
+    double average_sharpness;
+    int measured;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#include "stdafx.h"
+#include "ImuFile.h"
+
+#include <queue>
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+
+/// <sumary>
+/// Rewrites the sensor data into a CSV file of paired gyroscope and accelerometer samples.
+/// </sumary>
+/// <param name="imu_data_file">Sensor data file of the recording</param>
+/// <param name="start_sec">Start of the video, seconds</param>
+/// <param name="start_nano">Start of the video, nanoseconds</param>
+/// <param name="output_file">CSV file, to which the samples are written</param>
+/// <returns>0 on success, error code of the program otherwise</returns>
+int rewriteIMUfile(string imu_data_file, long* start_sec, long* start_nano, string output_file) {
+    fstream imuFile;
+    imuFile.open(imu_data_file);
+    if(imuFile.fail()) {
+        LOG(Error, Imu, "Could not read IMU data file: {}", imu_data_file);
+        return -4;
+    }
+
+    string line;
+    if(!getline(imuFile, line)) {
+        LOG(Error, Imu, "Wrong IMU file format");
+        return -5;
+    }
+    string nanosec = line.substr(line.size() - 9, 9);
+    string sec = line.substr(12, line.size() - 9 - 12);
+
+    *start_nano = stol(nanosec);
+    *start_sec = stol(sec);
+
+    // 1. create data.csv
+    ofstream outStream(output_file);
+    if(outStream) {
+        // 2. write the comment line
+        outStream << "#timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]" << endl;
+        
+        // 3. copy data line by line into memory:
+        // use three queues, one for strings, two for floats
+        queue<string> timestamps;
+        queue<string> gyr_data;
+        queue<string> acc_data;
+        for(int i = 0; getline(imuFile, line); i++) {
+            // check first string
+            stringstream stream(line);
+            string s;
+            getline(stream, s, ' ');
+            
+            if(s.compare("VIDEO_STOP") == 0) break;  // end of data
+
+            string sys_time_data, event_time_data;
+            getline(stream, sys_time_data, ' ');
+            getline(stream, event_time_data, ' ');
+
+            
+            if(s.compare("A") == 0) {
+                for(int j = 0; j < 3; j++) {
+                    getline(stream, s, ' ');
+                    acc_data.push(s);
+                }
+            } else if(s.compare("G") == 0) {
+                for(int j = 0; j < 3; j++) {
+                    getline(stream, s, ' ');
+                    gyr_data.push(s);
+                }
+            } else if(s.compare("M") == 0) {
+                // Magnetometer: TODO
+                continue;
+            } else {
+                // end of data
+                break;
+            }
+
+            // 4. write data line by line into file
+            if(acc_data.size() > 0 && gyr_data.size() > 0) {
+                // data is ready, dont remember time
+                outStream << timestamps.front();
+                timestamps.pop();
+
+                for(int j = 0; j < 3; j++) {
+                    outStream << "," << gyr_data.front();
+                    gyr_data.pop();
+                }
+                for(int j = 0; j < 3; j++) {
+                    outStream << "," << acc_data.front();
+                    acc_data.pop();
+                }
+
+                outStream << endl;
+
+            } else {
+                // new data, remember time
+                timestamps.push(sys_time_data);
+            }
+        }
+        
+        // 5. close file
+        outStream.close();
+    } else {
+        // TODO: handle file not opening
+    }
+    imuFile.close();
+    return 0;
+}
+
+// seconds of a timestamp in nanoseconds, as written in the sensor data file
+double imuTimestamp(const string& nanoseconds) {
+    string nanosec = nanoseconds.substr(nanoseconds.size() - 9, 9);
+    string sec = nanoseconds.substr(0, nanoseconds.size() - 9);
+    return atof((sec + "." + nanosec).c_str());
+}
+
+/// <sumary>
+/// Rewrites the sensor data into libRSF odom3 measurements, one per frame interval of the video.
+/// The samples are preintegrated as they are read, so the file is streamed and nothing but the last samples is kept.
+/// </sumary>
+/// <param name="imu_data_file">Sensor data file of the recording</param>
+/// <param name="fps">Frame rate of the video, the measurements are written at its frame times</param>
+/// <param name="start_sec">Start of the video, seconds</param>
+/// <param name="start_nano">Start of the video, nanoseconds</param>
+/// <param name="output_file">File, to which the measurements are written</param>
+/// <returns>0 on success, error code of the program otherwise</returns>
+int rewriteIMUfileToLibRSF(string imu_data_file, double fps, long* start_sec, long* start_nano, string output_file) {
+    fstream imuFile;
+    imuFile.open(imu_data_file);
+    if(imuFile.fail()) {
+        LOG(Error, Imu, "Could not read IMU data file: {}", imu_data_file);
+        return -4;
+    }
+
+    string line;
+    if(!getline(imuFile, line)) {
+        LOG(Error, Imu, "Wrong IMU file format");
+        return -5;
+    }
+    string nanosec = line.substr(line.size() - 9, 9);
+    string sec = line.substr(12, line.size() - 9 - 12);
+
+    *start_nano = stol(nanosec);
+    *start_sec = stol(sec);
+
+    ofstream outStream(output_file);
+    if(!outStream) {
+        LOG(Error, Imu, "Could not write IMU data file: {}", output_file);
+        return -4;
+    }
+
+    // accelerometer and gyroscope samples come in separate lines, they are paired in the order they arrive
+    queue<string> timestamps;
+    queue<Vec3d> gyr_data;
+    queue<Vec3d> acc_data;
+    ImuPreintegrator preintegrator;
+    double video_start = *start_sec + *start_nano * 1e-9;
+    long frame_num = 1;
+    int written = 0;
+    while(getline(imuFile, line)) {
+        stringstream stream(line);
+        string s;
+        getline(stream, s, ' ');
+
+        if(s.compare("VIDEO_STOP") == 0) break;  // end of data
+
+        string sys_time_data, event_time_data;
+        getline(stream, sys_time_data, ' ');
+        getline(stream, event_time_data, ' ');
+
+        Vec3d sample;
+        if(s.compare("A") == 0 || s.compare("G") == 0) {
+            for(int j = 0; j < 3; j++) {
+                string value;
+                getline(stream, value, ' ');
+                sample[j] = atof(value.c_str());
+            }
+            if(s.compare("A") == 0) acc_data.push(sample);
+            else gyr_data.push(sample);
+        } else if(s.compare("M") == 0) {
+            // Magnetometer: TODO
+            continue;
+        } else {
+            // end of data
+            break;
+        }
+
+        if(acc_data.empty() || gyr_data.empty()) {
+            // new data, remember time
+            timestamps.push(sys_time_data);
+            continue;
+        }
+
+        double ts = imuTimestamp(timestamps.front());
+        timestamps.pop();
+
+        // every frame time before this sample closes an interval
+        double frame_time = video_start + frame_num / fps;
+        while(preintegrator.isInitialized() && ts >= frame_time) {
+            ImuFactor factor = preintegrator.integrateTo(frame_time);
+            // odom3 time [s], velocity [m/s], turn rate [rad/s], their variances
+            outStream << "odom3 " << to_string(factor.end_time);
+            for(int j = 0; j < 3; j++) outStream << " " << factor.velocity[j];
+            for(int j = 0; j < 3; j++) outStream << " " << factor.turn_rate[j];
+            for(int j = 0; j < 3; j++) outStream << " " << factor.velocity_covariance(j, j);
+            for(int j = 0; j < 3; j++) outStream << " " << factor.turn_rate_covariance(j, j);
+            outStream << "\n";
+            written++;
+            frame_time = video_start + ++frame_num / fps;
+        }
+
+        preintegrator.addSample(ts, acc_data.front(), gyr_data.front());
+        acc_data.pop();
+        gyr_data.pop();
+
+        // frames before the gravity is known get no measurement
+        while(!preintegrator.isInitialized() && ts >= frame_time) frame_time = video_start + ++frame_num / fps;
+    }
+
+    addMetric(Metric::OutputBytes, (uint64_t) outStream.tellp());
+    outStream.close();
+    imuFile.close();
+    LOG(Info, Imu, "Preintegrated the IMU data into {} frame intervals", written);
+    return 0;
+}
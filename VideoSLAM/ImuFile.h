@@ -0,0 +1,12 @@
+#ifndef IMU_FILE_H
+#define IMU_FILE_H
+
+#include <string>
+
+
+// the sensor data file of the recording app is rewritten for the fusion with the camera poses
+int rewriteIMUfile(std::string imu_data_file, long* start_sec, long* start_nano, std::string output_file);
+int rewriteIMUfileToLibRSF(std::string imu_data_file, double fps, long* start_sec, long* start_nano, std::string output_file);
+double imuTimestamp(const std::string& nanoseconds);
+
+#endif
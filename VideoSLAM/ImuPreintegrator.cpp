@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include "ImuPreintegrator.h"
+
+using namespace std;
+using namespace cv;
+
+// rotations are re-orthonormalized every this many intervals, against the drift of the multiplied matrices
+static const int ORTHONORMALIZE_INTERVAL = 100;
+
+// matrix of the cross product with v
+static Matx33d skew(const Vec3d& v) {
+    return Matx33d(0, -v[2], v[1],
+                   v[2], 0, -v[0],
+                   -v[1], v[0], 0);
+}
+
+static Matx33d expRotation(const Vec3d& rotation_vector) {
+    Matx33d R;
+    Rodrigues(rotation_vector, R);
+    return R;
+}
+
+static Vec3d logRotation(const Matx33d& R) {
+    Vec3d rotation_vector;
+    Rodrigues(R, rotation_vector);
+    return rotation_vector;
+}
+
+static Matx33d orthonormalize(const Matx33d& R) {
+    return expRotation(logRotation(R));
+}
+
+template<int m, int n>
+static void setBlock(Matx<double, m, n>& M, int row, int col, const Matx33d& block) {
+    for(int i = 0; i < 3; i++) for(int j = 0; j < 3; j++) M(row + i, col + j) = block(i, j);
+}
+
+static Matx33d getBlock(const Matx<double, 9, 9>& M, int row, int col) {
+    Matx33d block;
+    for(int i = 0; i < 3; i++) for(int j = 0; j < 3; j++) block(i, j) = M(row + i, col + j);
+    return block;
+}
+
+ImuPreintegrator::ImuPreintegrator() {
+    this->gyro_noise_density = 0.002;
+    this->acc_noise_density = 0.02;
+    this->gravity_samples = 50;
+    this->has_sample = false;
+    this->last_time = 0;
+    this->gravity_count = 0;
+    this->gravity = Vec3d(0, 0, 0);
+    this->orientation = Matx33d::eye();
+    this->velocity = Vec3d(0, 0, 0);
+    this->state_covariance = Matx<double, 9, 9>::zeros();
+    this->interval_count = 0;
+    resetInterval(0);
+}
+
+ImuPreintegrator::~ImuPreintegrator() = default;
+
+/// <sumary>
+/// Adds the next sample. The previous sample is integrated up to the time of this one.
+/// </sumary>
+/// <param name="timestamp">Time of the sample in seconds, not earlier than the previous one</param>
+/// <param name="acc">Accelerometer reading with gravity, m/s^2</param>
+/// <param name="gyr">Gyroscope reading, rad/s</param>
+void ImuPreintegrator::addSample(double timestamp, const Vec3d& acc, const Vec3d& gyr) {
+    if(!isInitialized()) {
+        // phone at rest measures the opposite of gravity
+        gravity -= acc;
+        gravity_count++;
+        if(isInitialized()) {
+            gravity /= gravity_count;
+            LOG(Debug, Imu, "Gravity {} m/s^2 from {} samples", norm(gravity), gravity_count);
+        }
+        resetInterval(timestamp);
+    } else if(has_sample && timestamp > last_time) {
+        integrate(timestamp - last_time);
+    }
+
+    has_sample = true;
+    last_time = timestamp;
+    last_acc = acc;
+    last_gyr = gyr;
+}
+
+/// <sumary>
+/// Closes the current interval and starts the next one. The last sample is held up to the given time.
+/// </sumary>
+/// <param name="timestamp">End of the interval in seconds, not earlier than the last sample</param>
+/// <returns>Relative motion over the interval, all zero before the gravity is known</returns>
+ImuFactor ImuPreintegrator::integrateTo(double timestamp) {
+    if(isInitialized() && has_sample && timestamp > last_time) {
+        integrate(timestamp - last_time);
+        last_time = timestamp;
+    }
+
+    ImuFactor factor;
+    factor.start_time = interval_start;
+    factor.end_time = timestamp;
+    factor.delta_rotation = delta_rotation;
+    factor.delta_velocity = delta_velocity;
+    factor.delta_position = delta_position;
+    factor.velocity_covariance = Matx33d::zeros();
+    factor.turn_rate_covariance = Matx33d::zeros();
+
+    double dt = timestamp - interval_start;
+    if(isInitialized() && dt > 0) {
+        Matx33d R_t = orientation.t();
+        Vec3d start_velocity = velocity + gravity * (dt / 2);
+        factor.turn_rate = logRotation(delta_rotation) / dt;
+        factor.velocity = R_t * start_velocity + delta_position / dt;
+        factor.turn_rate_covariance = getBlock(covariance, 0, 0) * (1 / (dt * dt));
+
+        // the start state is dead reckoned, its rotation error turns the velocity and gravity into the phone's frame wrongly
+        Matx<double, 3, 9> J = Matx<double, 3, 9>::zeros();
+        setBlock(J, 0, 0, skew(R_t * start_velocity));
+        setBlock(J, 0, 3, R_t);
+        factor.velocity_covariance = J * state_covariance * J.t() + getBlock(covariance, 6, 6) * (1 / (dt * dt));
+
+        // move the state and its covariance to the end of the interval, with the interval's motion and noise
+        Matx<double, 9, 9> F = Matx<double, 9, 9>::eye();
+        setBlock(F, 0, 0, delta_rotation.t());
+        setBlock(F, 3, 0, orientation * skew(delta_velocity) * -1);
+        setBlock(F, 6, 0, orientation * skew(delta_position) * -1);
+        setBlock(F, 6, 3, Matx33d::eye() * dt);
+
+        Matx<double, 9, 9> G = Matx<double, 9, 9>::eye();
+        setBlock(G, 3, 3, orientation);
+        setBlock(G, 6, 6, orientation);
+        state_covariance = F * state_covariance * F.t() + G * covariance * G.t();
+
+        velocity += gravity * dt + orientation * delta_velocity;
+        orientation = orientation * delta_rotation;
+
+        if(++interval_count % ORTHONORMALIZE_INTERVAL == 0) orientation = orthonormalize(orientation);
+    }
+
+    resetInterval(timestamp);
+    return factor;
+}
+
+// integrates the last sample over dt seconds, the noise is propagated as in Forster et al., On-Manifold Preintegration
+void ImuPreintegrator::integrate(double dt) {
+    Matx33d rotation_step = expRotation(last_gyr * dt);
+    // the acceleration is rotated half way through the step, so a steady turn does not bias the velocity
+    Vec3d acc = delta_rotation * expRotation(last_gyr * (dt / 2)) * last_acc;
+    Matx33d acc_skew = delta_rotation * skew(last_acc);
+
+    // covariance of the new state, from the old state and the sample's noise
+    Matx<double, 9, 9> A = Matx<double, 9, 9>::eye();
+    setBlock(A, 0, 0, rotation_step.t());
+    setBlock(A, 3, 0, acc_skew * -dt);
+    setBlock(A, 6, 0, acc_skew * (-dt * dt / 2));
+    setBlock(A, 6, 3, Matx33d::eye() * dt);
+
+    Matx<double, 9, 6> B = Matx<double, 9, 6>::zeros();
+    setBlock(B, 0, 0, Matx33d::eye() * dt);
+    setBlock(B, 3, 3, delta_rotation * dt);
+    setBlock(B, 6, 3, delta_rotation * (dt * dt / 2));
+
+    // noise densities turned into the variance of a single sample
+    Matx<double, 6, 6> Q = Matx<double, 6, 6>::zeros();
+    double gyro_variance = gyro_noise_density * gyro_noise_density / dt;
+    double acc_variance = acc_noise_density * acc_noise_density / dt;
+    for(int i = 0; i < 3; i++) {
+        Q(i, i) = gyro_variance;
+        Q(i + 3, i + 3) = acc_variance;
+    }
+    covariance = A * covariance * A.t() + B * Q * B.t();
+
+    delta_position += delta_velocity * dt + acc * (dt * dt / 2);
+    delta_velocity += acc * dt;
+    delta_rotation = delta_rotation * rotation_step;
+}
+
+void ImuPreintegrator::resetInterval(double timestamp) {
+    interval_start = timestamp;
+    delta_rotation = Matx33d::eye();
+    delta_velocity = Vec3d(0, 0, 0);
+    delta_position = Vec3d(0, 0, 0);
+    covariance = Matx<double, 9, 9>::zeros();
+}
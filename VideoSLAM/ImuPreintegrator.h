@@ -0,0 +1,67 @@
+#ifndef IMU_PREINTEGRATOR_H
+#define IMU_PREINTEGRATOR_H
+
+
+// relative motion of the phone over one interval, written as a single libRSF odom3 measurement
+struct ImuFactor {
+    double start_time = 0;              // seconds
+    double end_time = 0;
+    cv::Matx33d delta_rotation;         // end orientation in the frame of the start orientation
+    cv::Vec3d delta_velocity;           // change of velocity without gravity, in the frame of the start orientation, m/s
+    cv::Vec3d delta_position;           // same for the position, in meters
+    cv::Vec3d velocity;                 // mean velocity over the interval, in the frame of the start orientation, m/s
+    cv::Vec3d turn_rate;                // mean turn rate over the interval, rad/s
+    cv::Matx33d velocity_covariance;    // (m/s)^2
+    cv::Matx33d turn_rate_covariance;   // (rad/s)^2
+};
+
+/// <sumary>
+/// Streaming preintegration of gyroscope and accelerometer samples on the rotation manifold.
+/// Samples are folded into the relative motion of the current interval as they arrive, together with its covariance,
+/// so only the running sums and the last sample are kept, however long the recording is.
+/// The first samples are averaged into the gravity direction, the phone has to lie still while they are recorded.
+/// </sumary>
+class ImuPreintegrator {
+public:
+    // attributes
+    double gyro_noise_density;          // rad/s/sqrt(Hz)
+    double acc_noise_density;           // m/s^2/sqrt(Hz)
+    int gravity_samples;                // samples averaged into gravity, before any motion is integrated
+
+    // constructors & deconstructors
+    ImuPreintegrator();
+    virtual ~ImuPreintegrator();
+
+    // methods
+    void addSample(double timestamp, const cv::Vec3d& acc, const cv::Vec3d& gyr);
+    bool isInitialized() const { return gravity_count >= gravity_samples; }
+    ImuFactor integrateTo(double timestamp);
+
+private:
+    // last sample, held until the next one arrives
+    bool has_sample;
+    double last_time;
+    cv::Vec3d last_acc, last_gyr;
+
+    // gravity in the world frame, which is the phone's frame at the end of the initialization
+    int gravity_count;
+    cv::Vec3d gravity;
+
+    // navigation state at the start of the current interval, dead reckoned since the initialization. Its covariance
+    // is ordered rotation (in the phone's frame), velocity, position (in the world frame), so tilt errors reach the velocity.
+    cv::Matx33d orientation;
+    cv::Vec3d velocity;
+    cv::Matx<double, 9, 9> state_covariance;
+    int interval_count;
+
+    // motion preintegrated since the start of the interval, the covariance is ordered rotation, velocity, position
+    double interval_start;
+    cv::Matx33d delta_rotation;
+    cv::Vec3d delta_velocity, delta_position;
+    cv::Matx<double, 9, 9> covariance;
+
+    void integrate(double dt);
+    void resetInterval(double timestamp);
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "stdafx.h"
+#include "Log.h"
+
+using namespace std;
+
+atomic<int> log_levels[(int) LogModule::Count] = {
+    {(int) LogLevel::Info}, {(int) LogLevel::Info}, {(int) LogLevel::Info},
+    {(int) LogLevel::Info}, {(int) LogLevel::Info}, {(int) LogLevel::Info}
+};
+
+static const char* LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+static const char* MODULE_NAMES[] = {"main", "calibration", "detection", "slam", "imu", "preview"};
+
+static const chrono::steady_clock::time_point log_start = chrono::steady_clock::now();
+
+// single producer, single consumer ring of log records, one per logging thread
+struct LogRing {
+    static const size_t CAPACITY = 1024;
+
+    LogRecord records[CAPACITY];
+    atomic<size_t> head{0};             // written by the logging thread
+    atomic<size_t> tail{0};             // written by the sink
+    atomic<uint64_t> dropped{0};
+
+    bool push(const LogRecord& record) {
+        size_t h = head.load(memory_order_relaxed);
+        if(h - tail.load(memory_order_acquire) >= CAPACITY) {
+            // never wait on the sink
+            dropped.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        records[h & (CAPACITY - 1)] = record;
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(LogRecord& record) {
+        size_t t = tail.load(memory_order_relaxed);
+        if(t == head.load(memory_order_acquire)) return false;
+        record = records[t & (CAPACITY - 1)];
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+};
+
+// collects the records of all threads on a background thread, formats and writes them
+class LogSink {
+public:
+    LogSink() {
+        running = true;
+        sink_thread = thread(&LogSink::run, this);
+    }
+
+    ~LogSink() {
+        running = false;
+        sink_thread.join();
+        drain();
+    }
+
+    LogRing* registerRing() {
+        lock_guard<mutex> lock(rings_mutex);
+        rings.push_back(unique_ptr<LogRing>(new LogRing()));
+        return rings.back().get();
+    }
+
+    bool setFile(string fileName) {
+        lock_guard<mutex> lock(drain_mutex);
+        file.close();
+        file.open(fileName);
+        return file.is_open();
+    }
+
+    // writes everything logged so far, returns the number of records
+    size_t drain() {
+        lock_guard<mutex> drain_lock(drain_mutex);
+        {
+            lock_guard<mutex> lock(rings_mutex);
+            for(size_t i = 0; i < rings.size(); i++) {
+                LogRecord record;
+                while(rings[i]->pop(record)) batch.push_back(record);
+
+                uint64_t dropped = rings[i]->dropped.exchange(0);
+                if(dropped > 0) {
+                    LogRecord note;
+                    note.time = logTime();
+                    note.format = "{} log records dropped, the ring buffer was full";
+                    note.level = LogLevel::Warning;
+                    note.module = LogModule::Main;
+                    note.num_arguments = 0;
+                    note.text_used = 0;
+                    addLogArgument(note, (unsigned long long) dropped);
+                    batch.push_back(note);
+                }
+            }
+        }
+        setMetric(Metric::LogQueue, batch.size());
+        if(batch.empty()) return 0;
+
+        // records of different threads in the order they were made
+        stable_sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) { return a.time < b.time; });
+        for(size_t i = 0; i < batch.size(); i++) {
+            format(batch[i], line);
+            ostream& out = file.is_open() ? (ostream&) file : batch[i].level >= LogLevel::Warning ? cerr : cout;
+            out << line;
+        }
+        if(file.is_open()) file.flush();
+        else cout.flush();
+
+        size_t count = batch.size();
+        batch.clear();
+        return count;
+    }
+
+private:
+    atomic<bool> running;
+    thread sink_thread;
+    mutex rings_mutex, drain_mutex;
+    vector<unique_ptr<LogRing>> rings;
+    vector<LogRecord> batch;
+    string line;
+    ofstream file;
+
+    void run() {
+        while(running) {
+            if(drain() == 0) this_thread::sleep_for(chrono::milliseconds(5));
+        }
+    }
+
+    static void format(const LogRecord& record, string& line) {
+        ostringstream stream;
+        stream.setf(ios::fixed, ios::floatfield);
+        stream.precision(6);
+        stream << "[" << record.time / 1e9 << "] ";
+        stream.unsetf(ios::floatfield);
+        stream << LEVEL_NAMES[(int) record.level] << " " << MODULE_NAMES[(int) record.module] << ": ";
+
+        int argument = 0;
+        for(const char* c = record.format; *c != '\0'; c++) {
+            if(c[0] != '{' || c[1] != '}' || argument >= record.num_arguments) {
+                stream << *c;
+                continue;
+            }
+            c++;
+
+            const LogArgument& a = record.arguments[argument];
+            switch(a.type) {
+            case LogArgument::Integer:
+                stream << a.integer;
+                argument++;
+                break;
+            case LogArgument::Real:
+                stream << a.real;
+                argument++;
+                break;
+            case LogArgument::Text:
+                stream << record.text + a.text_offset;
+                argument++;
+                break;
+            case LogArgument::Vector3:
+                stream << "[" << a.real << ", " << record.arguments[argument + 1].real << ", " << record.arguments[argument + 2].real << "]";
+                argument += 3;
+                break;
+            case LogArgument::Matrix33:
+                stream << "[";
+                for(int i = 0; i < 9; i++) {
+                    stream << record.arguments[argument + i].real << (i == 8 ? "]" : i % 3 == 2 ? ";\n " : ", ");
+                }
+                argument += 9;
+                break;
+            default:
+                argument++;
+                break;
+            }
+        }
+        stream << "\n";
+        line = stream.str();
+    }
+};
+
+static LogSink log_sink;
+static thread_local LogRing* thread_ring = nullptr;
+
+int64_t logTime() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - log_start).count();
+}
+
+void submitLogRecord(const LogRecord& record) {
+    if(thread_ring == nullptr) thread_ring = log_sink.registerRing();
+    thread_ring->push(record);
+}
+
+void setLogLevel(LogLevel level) {
+    for(int i = 0; i < (int) LogModule::Count; i++) {
+        log_levels[i] = (int) level;
+    }
+}
+
+void setLogLevel(LogModule module, LogLevel level) {
+    log_levels[(int) module] = (int) level;
+}
+
+/// <sumary>
+/// Writes the log into a file instead of the console.
+/// </sumary>
+/// <param name="fileName">Path to the log file</param>
+/// <returns>False if the file could not be opened</returns>
+bool setLogFile(string fileName) {
+    return log_sink.setFile(fileName);
+}
+
+// writes out everything logged so far, before waiting for user input or exiting
+void flushLog() {
+    log_sink.drain();
+}
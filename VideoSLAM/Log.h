@@ -0,0 +1,130 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <opencv2/core.hpp>
+
+
+enum class LogLevel { Trace, Debug, Info, Warning, Error, Off };
+enum class LogModule { Main, Calibration, Detection, Slam, Imu, Preview, Count };
+
+static const int LOG_MAX_ARGUMENTS = 16;
+static const int LOG_TEXT_SIZE = 128;
+
+// single argument of a log message, formatted later by the sink
+struct LogArgument {
+    enum Type : uint8_t { Integer, Real, Text, Vector3, Matrix33, Continued };
+    Type type;
+    union {
+        int64_t integer;
+        double real;
+        uint16_t text_offset;           // into LogRecord::text
+    };
+};
+
+// log message as it is stored in the per-thread ring buffers
+struct LogRecord {
+    int64_t time;                       // nanoseconds since the program start
+    const char* format;                 // string literal, every "{}" is replaced by the next argument
+    LogLevel level;
+    LogModule module;
+    uint8_t num_arguments;
+    uint8_t text_used;
+    LogArgument arguments[LOG_MAX_ARGUMENTS];
+    char text[LOG_TEXT_SIZE];           // copies of the text arguments
+};
+
+// lowest enabled level of every module
+extern std::atomic<int> log_levels[(int) LogModule::Count];
+
+inline bool logEnabled(LogLevel level, LogModule module) {
+    return (int) level >= log_levels[(int) module].load(std::memory_order_relaxed);
+}
+
+void setLogLevel(LogLevel level);
+void setLogLevel(LogModule module, LogLevel level);
+bool setLogFile(std::string fileName);
+void flushLog();
+int64_t logTime();
+void submitLogRecord(const LogRecord& record);
+
+// arguments are copied into the record, never formatted on the logging thread
+inline void addLogArgument(LogRecord& record, long long value) {
+    if(record.num_arguments >= LOG_MAX_ARGUMENTS) return;
+    LogArgument& argument = record.arguments[record.num_arguments++];
+    argument.type = LogArgument::Integer;
+    argument.integer = value;
+}
+inline void addLogArgument(LogRecord& record, int value) { addLogArgument(record, (long long) value); }
+inline void addLogArgument(LogRecord& record, long value) { addLogArgument(record, (long long) value); }
+inline void addLogArgument(LogRecord& record, unsigned int value) { addLogArgument(record, (long long) value); }
+inline void addLogArgument(LogRecord& record, unsigned long value) { addLogArgument(record, (long long) value); }
+inline void addLogArgument(LogRecord& record, unsigned long long value) { addLogArgument(record, (long long) value); }
+
+inline void addLogArgument(LogRecord& record, double value) {
+    if(record.num_arguments >= LOG_MAX_ARGUMENTS) return;
+    LogArgument& argument = record.arguments[record.num_arguments++];
+    argument.type = LogArgument::Real;
+    argument.real = value;
+}
+inline void addLogArgument(LogRecord& record, float value) { addLogArgument(record, (double) value); }
+
+inline void addLogArgument(LogRecord& record, const char* value) {
+    if(record.num_arguments >= LOG_MAX_ARGUMENTS) return;
+    LogArgument& argument = record.arguments[record.num_arguments++];
+    argument.type = LogArgument::Text;
+    argument.text_offset = record.text_used;
+
+    // truncated to what is left of the text buffer
+    while(*value != '\0' && record.text_used < LOG_TEXT_SIZE - 1) {
+        record.text[record.text_used++] = *value++;
+    }
+    record.text[record.text_used] = '\0';
+    if(record.text_used < LOG_TEXT_SIZE - 1) record.text_used++;
+}
+inline void addLogArgument(LogRecord& record, const std::string& value) { addLogArgument(record, value.c_str()); }
+
+inline void addLogArgument(LogRecord& record, const double* values, int count, LogArgument::Type type) {
+    if(record.num_arguments + count > LOG_MAX_ARGUMENTS) return;
+    for(int i = 0; i < count; i++) {
+        LogArgument& argument = record.arguments[record.num_arguments++];
+        argument.type = i == 0 ? type : LogArgument::Continued;
+        argument.real = values[i];
+    }
+}
+inline void addLogArgument(LogRecord& record, const cv::Vec3d& value) { addLogArgument(record, value.val, 3, LogArgument::Vector3); }
+inline void addLogArgument(LogRecord& record, const cv::Matx33d& value) { addLogArgument(record, value.val, 9, LogArgument::Matrix33); }
+inline void addLogArgument(LogRecord& record, const cv::Mat& value) {
+    if(value.rows == 3 && value.cols == 3 && value.type() == CV_64F) addLogArgument(record, (cv::Matx33d) value);
+    else addLogArgument(record, "[Mat]");
+}
+
+inline void addLogArguments(LogRecord& record) {}
+
+template<typename T, typename... Args>
+inline void addLogArguments(LogRecord& record, const T& first, const Args&... rest) {
+    addLogArgument(record, first);
+    addLogArguments(record, rest...);
+}
+
+template<typename... Args>
+void logMessage(LogLevel level, LogModule module, const char* format, const Args&... args) {
+    LogRecord record;
+    record.time = logTime();
+    record.format = format;
+    record.level = level;
+    record.module = module;
+    record.num_arguments = 0;
+    record.text_used = 0;
+    addLogArguments(record, args...);
+    submitLogRecord(record);
+}
+
+// arguments are not evaluated when the level is disabled for the module
+#define LOG(level, module, ...) do { \
+        if(logEnabled(LogLevel::level, LogModule::module)) logMessage(LogLevel::level, LogModule::module, __VA_ARGS__); \
+    } while(0)
+
+#endif
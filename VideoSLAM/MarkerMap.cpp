@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "MarkerMap.h"
+
+using namespace std;
+
+/// <sumary>
+/// Creates an empty map.
+/// </sumary>
+/// <param name="num_of_markers">Maximal number of markers in the map</param>
+MarkerMap::MarkerMap(int num_of_markers) : markers(num_of_markers) {
+    this->marker_counter = 0;
+    this->id_indices.reserve(num_of_markers);
+}
+
+MarkerMap::~MarkerMap() = default;
+
+int MarkerMap::getCapacity() const {
+    return (int) markers.size();
+}
+
+int MarkerMap::getMarkerCounter() const {
+    shared_lock<shared_timed_mutex> lock(map_mutex);
+    return marker_counter;
+}
+
+/// <sumary>
+/// Finds the mapped markers with the given IDs.
+/// </sumary>
+/// <param name="ids">IDs of the markers</param>
+/// <param name="count">Number of IDs</param>
+/// <param name="found">World poses of the mapped markers, one for each ID. Unmapped markers are left unchanged.</param>
+/// <param name="indices">Indices of the markers in the map, -1 for unmapped markers</param>
+void MarkerMap::lookup(const int* ids, size_t count, MarkerPose* found, int* indices) const {
+    shared_lock<shared_timed_mutex> lock(map_mutex);
+    for(size_t i = 0; i < count; i++) {
+        auto index = id_indices.find(ids[i]);
+        if(index == id_indices.end()) {
+            indices[i] = -1;
+            continue;
+        }
+
+        const MarkerInfo& marker = markers[index->second];
+        found[i].previous_marker_index = marker.previous_marker_index;
+        found[i].world_position = marker.world_position;
+        found[i].world_orientation_matrix = (cv::Matx33d) marker.world_orientation_matrix;
+        indices[i] = index->second;
+    }
+}
+
+/// <sumary>
+/// Copies all map slots, including the unused ones, and the number of mapped markers.
+/// </sumary>
+void MarkerMap::snapshot(vector<MarkerInfo>& markers, int& marker_counter) const {
+    shared_lock<shared_timed_mutex> lock(map_mutex);
+    markers = this->markers;
+    marker_counter = this->marker_counter;
+}
+
+vector<MarkerInfo> MarkerMap::getMappedMarkers() const {
+    shared_lock<shared_timed_mutex> lock(map_mutex);
+    return vector<MarkerInfo>(markers.begin(), markers.begin() + marker_counter);
+}
+
+/// <sumary>
+/// Sets the marker as the world's origin, if the map is still empty.
+/// </sumary>
+/// <returns>False if another marker already is the origin</returns>
+bool MarkerMap::setOrigin(const MarkerInfo& marker) {
+    unique_lock<shared_timed_mutex> lock(map_mutex);
+    if(marker_counter != 0 || markers.empty()) return false;
+
+    markers[0] = marker;
+    marker_counter = 1;
+    id_indices[marker.marker_id] = 0;
+    addMetric(Metric::MarkersMapped);
+    return true;
+}
+
+/// <sumary>
+/// Adds a marker with a computed world pose to the map. If another tracker has mapped the marker in the meantime,
+/// the map is left unchanged and the marker is overwritten with the mapped one.
+/// </sumary>
+/// <param name="marker">Marker to add</param>
+/// <returns>Index of the marker in the map, -1 if the map is full</returns>
+int MarkerMap::insert(MarkerInfo& marker) {
+    unique_lock<shared_timed_mutex> lock(map_mutex);
+    auto mapped = id_indices.find(marker.marker_id);
+    if(mapped != id_indices.end()) {
+        marker = markers[mapped->second];
+        return mapped->second;
+    }
+
+    if(marker_counter >= (int) markers.size()) return -1;
+
+    markers[marker_counter] = marker;
+    id_indices[marker.marker_id] = marker_counter;
+    addMetric(Metric::MarkersMapped);
+    return marker_counter++;
+}
+
+/// <sumary>
+/// Replaces the world pose of a mapped marker with a refined one.
+/// </sumary>
+/// <param name="index">Index of the marker in the map</param>
+void MarkerMap::updatePose(int index, const cv::Vec3d& world_position, const cv::Matx33d& world_orientation_matrix) {
+    unique_lock<shared_timed_mutex> lock(map_mutex);
+    if(index < 0 || index >= marker_counter) return;
+
+    markers[index].world_position = world_position;
+    markers[index].world_orientation_matrix = cv::Mat(world_orientation_matrix);
+    markers[index].world_orientation = cv::Quat<double>::createFromRotMat(markers[index].world_orientation_matrix);
+}
@@ -0,0 +1,51 @@
+#ifndef MARKER_MAP_H
+#define MARKER_MAP_H
+
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+
+// previous_marker_index of the marker at the world's origin
+static const int WORLD = -2;
+
+// world pose of a mapped marker, copied out of the map without touching the heap
+struct MarkerPose {
+    int previous_marker_index = -1;
+    cv::Vec3d world_position;
+    cv::Matx33d world_orientation_matrix;
+};
+
+/// <sumary>
+/// World poses of the mapped markers, shared by the trackers of all cameras of a rig.
+/// Any number of trackers can read the map at once, updates are serialized.
+/// Markers are indexed by their IDs, so finding the detected markers costs as much as the markers involved, not as the whole map.
+/// </sumary>
+class MarkerMap {
+public:
+    // constructors & deconstructors
+    MarkerMap(int num_of_markers);
+    virtual ~MarkerMap();
+
+    // readers
+    int getCapacity() const;
+    int getMarkerCounter() const;
+    void lookup(const int* ids, size_t count, MarkerPose* found, int* indices) const;
+    void snapshot(std::vector<MarkerInfo>& markers, int& marker_counter) const;
+    std::vector<MarkerInfo> getMappedMarkers() const;
+
+    // writers
+    bool setOrigin(const MarkerInfo& marker);
+    int insert(MarkerInfo& marker);
+    void updatePose(int index, const cv::Vec3d& world_position, const cv::Matx33d& world_orientation_matrix);
+
+private:
+    mutable std::shared_timed_mutex map_mutex;
+    std::vector<MarkerInfo> markers;
+    int marker_counter;
+
+    // indices of the mapped markers by their IDs
+    std::unordered_map<int, int> id_indices;
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include "stdafx.h"
+#include "Metrics.h"
+
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const uint32_t METRICS_MAGIC = 0x4D534C56;      // "VLSM"
+static const uint32_t METRICS_VERSION = 3;
+
+// names in the Prometheus export, with their types and descriptions
+struct MetricDescription {
+    const char* name;
+    const char* type;
+    const char* help;
+};
+
+static const MetricDescription METRIC_DESCRIPTIONS[] = {
+    {"videoslam_frames_processed_total", "counter", "Frames processed by the trackers"},
+    {"videoslam_frames_detected_total", "counter", "Frames with at least one detected marker"},
+    {"videoslam_frames_tracked_total", "counter", "Frames in which the marker corners were tracked instead of detected"},
+    {"videoslam_frames_blurred_total", "counter", "Frames skipped as blurred or badly exposed"},
+    {"videoslam_frames_missing_total", "counter", "Frames without a camera pose"},
+    {"videoslam_markers_detected_total", "counter", "Markers detected over all frames"},
+    {"videoslam_markers_mapped", "gauge", "Markers in the marker maps"},
+    {"videoslam_output_bytes_total", "counter", "Bytes written to the output files"},
+    {"videoslam_bundle_adjuster_queue", "gauge", "Frames waiting for the bundle adjustment"},
+    {"videoslam_log_queue", "gauge", "Log records waiting for the log sink"},
+};
+static_assert(sizeof(METRIC_DESCRIPTIONS) / sizeof(METRIC_DESCRIPTIONS[0]) == (size_t) Metric::Count, "Every metric needs a description");
+
+static const char* STAGE_NAMES[] = {"decode", "detection", "map_update", "frame"};
+
+// counters of this process, in the shared segment once it is open. Every thread reads the pointer.
+static MetricsBlock local_block;
+static atomic<MetricsBlock*> metrics_block(&local_block);
+static void* metrics_handle = nullptr;
+static string metrics_name;
+
+static string segmentName(string name) {
+#ifdef _WIN32
+    return "Local\\" + name;
+#else
+    return "/" + name;
+#endif
+}
+
+string metricsSegmentName() {
+#ifdef _WIN32
+    return metricsSegmentName((uint64_t) GetCurrentProcessId());
+#else
+    return metricsSegmentName((uint64_t) getpid());
+#endif
+}
+
+string metricsSegmentName(uint64_t process_id) {
+    return METRICS_SEGMENT_PREFIX + to_string(process_id);
+}
+
+static uint64_t systemTime() {
+    return (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void copyBlock(const MetricsBlock& from, MetricsBlock& to) {
+    for(int i = 0; i < (int) Metric::Count; i++) to.values[i].store(from.values[i].load());
+    for(int i = 0; i < (int) Stage::Count; i++) {
+        to.stage_total[i].store(from.stage_total[i].load());
+        to.stage_last[i].store(from.stage_last[i].load());
+        to.stage_count[i].store(from.stage_count[i].load());
+    }
+}
+
+/// <sumary>
+/// Moves the metrics of the process into a shared memory segment, that other processes can read.
+/// Has to be called before the worker threads start.
+/// </sumary>
+/// <param name="name">Name of the segment. An existing segment of that name belongs to another run and is left alone.</param>
+/// <returns>False if the segment could not be created, the metrics are then only kept in the process</returns>
+bool openMetrics(string name) {
+    closeMetrics();
+
+    void* memory = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(MetricsBlock), segmentName(name).c_str());
+    if(mapping != nullptr && GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        LOG(Warning, Main, "The metrics segment {} is used by another process", name);
+        return false;
+    }
+    if(mapping != nullptr) {
+        memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(MetricsBlock));
+        if(memory == nullptr) CloseHandle(mapping);
+        else metrics_handle = mapping;
+    }
+#else
+    int fd = shm_open(segmentName(name).c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0 && errno == EEXIST) {
+        // a crashed run does not remove its segment, it is then found under /dev/shm
+        LOG(Warning, Main, "The metrics segment {} is used by another process", name);
+        return false;
+    }
+    if(fd >= 0) {
+        if(ftruncate(fd, sizeof(MetricsBlock)) == 0) {
+            memory = mmap(nullptr, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(memory == MAP_FAILED) memory = nullptr;
+        }
+        ::close(fd);
+    }
+#endif
+    if(memory == nullptr) {
+        LOG(Warning, Main, "Could not create the shared memory for the metrics: {}", name);
+        return false;
+    }
+
+    // counters made before the segment was opened are carried over
+    MetricsBlock* block = new (memory) MetricsBlock();
+    copyBlock(local_block, *block);
+    block->start_time = systemTime();
+    block->end_time = 0;
+    block->version = METRICS_VERSION;
+    block->magic = METRICS_MAGIC;
+
+    metrics_block.store(block, memory_order_release);
+    metrics_name = name;
+    return true;
+}
+
+/// <sumary>
+/// Marks the run as finished and removes the name of the shared memory segment. Readers, that have it open, keep their view of it.
+/// The segment stays mapped until the process exits: closeMetrics runs at exit, while threads like the log sink
+/// may still be updating the counters through the pointer they have loaded.
+/// </sumary>
+void closeMetrics() {
+    MetricsBlock* block = metrics_block.load(memory_order_acquire);
+    if(block == &local_block) return;
+
+    block->end_time = systemTime();
+    copyBlock(*block, local_block);
+    metrics_block.store(&local_block, memory_order_release);
+
+#ifdef _WIN32
+    // the mapped view keeps the segment alive until the process exits
+    CloseHandle((HANDLE) metrics_handle);
+#else
+    shm_unlink(segmentName(metrics_name).c_str());
+#endif
+    metrics_handle = nullptr;
+}
+
+MetricsBlock& metrics() {
+    return *metrics_block.load(memory_order_acquire);
+}
+
+// monotonic time in nanoseconds, for measuring the stages
+uint64_t metricsTime() {
+    return (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+MetricsReader::MetricsReader() {
+    this->block = nullptr;
+    this->handle = nullptr;
+    this->last_frames = 0;
+    this->last_time = 0;
+}
+
+MetricsReader::~MetricsReader() {
+    close();
+}
+
+/// <sumary>
+/// Opens the metrics of a running process for reading.
+/// </sumary>
+/// <param name="name">Name of the segment the process exports its metrics in</param>
+/// <returns>False if no process exports metrics under that name</returns>
+bool MetricsReader::open(string name) {
+    close();
+
+    void* memory = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, segmentName(name).c_str());
+    if(mapping == nullptr) return false;
+    memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(MetricsBlock));
+    if(memory == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+    handle = mapping;
+#else
+    int fd = shm_open(segmentName(name).c_str(), O_RDONLY, 0);
+    if(fd < 0) return false;
+    memory = mmap(nullptr, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(memory == MAP_FAILED) return false;
+#endif
+
+    block = (const MetricsBlock*) memory;
+    if(block->magic != METRICS_MAGIC || block->version != METRICS_VERSION) {
+        LOG(Warning, Main, "The metrics segment {} has an unknown format", name);
+        close();
+        return false;
+    }
+    last_frames = block->values[(int) Metric::FramesProcessed].load();
+    last_time = systemTime();
+    return true;
+}
+
+void MetricsReader::close() {
+    if(block == nullptr) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(block);
+    CloseHandle((HANDLE) handle);
+#else
+    munmap((void*) block, sizeof(MetricsBlock));
+#endif
+    block = nullptr;
+    handle = nullptr;
+}
+
+/// <sumary>
+/// Prints the counters in a human readable form. The current frame rate is measured since the previous call.
+/// </sumary>
+void MetricsReader::print(ostream& out) {
+    if(block == nullptr) return;
+
+    uint64_t now = systemTime();
+    uint64_t end_time = block->end_time.load();
+    uint64_t frames = block->values[(int) Metric::FramesProcessed].load();
+    double elapsed = ((end_time != 0 ? end_time : now) - block->start_time.load()) / 1e9;
+    double since_last = (now - last_time) / 1e9;
+    double current_fps = since_last > 0 ? (frames - last_frames) / since_last : 0;
+    last_frames = frames;
+    last_time = now;
+
+    double frame_count = (double) max<uint64_t>(frames, 1);
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out.setf(ios::fixed, ios::floatfield);
+    out.precision(1);
+
+    out << "Running for " << elapsed << " s" << (end_time != 0 ? ", finished" : "") << "\n";
+    out << "  frames processed  " << frames << "\n";
+    out << "  fps               " << current_fps << " current, " << (elapsed > 0 ? frames / elapsed : 0) << " average\n";
+    out << "  detection rate    " << 100 * block->values[(int) Metric::FramesDetected].load() / frame_count << " % of frames, "
+        << block->values[(int) Metric::MarkersDetected].load() / frame_count << " markers per frame\n";
+    out << "  tracked frames    " << 100 * block->values[(int) Metric::FramesTracked].load() / frame_count << " %\n";
+    out << "  blurred frames    " << 100 * block->values[(int) Metric::FramesBlurred].load() / frame_count << " %\n";
+    out << "  missing frames    " << 100 * block->values[(int) Metric::FramesMissing].load() / frame_count << " %\n";
+    out << "  markers mapped    " << block->values[(int) Metric::MarkersMapped].load() << "\n";
+    out << "  output bytes      " << block->values[(int) Metric::OutputBytes].load() << "\n";
+    out << "  queues            bundle adjuster " << block->values[(int) Metric::BundleAdjusterQueue].load()
+        << ", log " << block->values[(int) Metric::LogQueue].load() << "\n";
+    out.precision(2);
+    out << "  latency (ms)     ";
+    for(int i = 0; i < (int) Stage::Count; i++) {
+        uint64_t count = block->stage_count[i].load();
+        double average = count > 0 ? block->stage_total[i].load() / 1e6 / count : 0;
+        out << " " << STAGE_NAMES[i] << " " << block->stage_last[i].load() / 1e6 << " (avg " << average << ")";
+    }
+    out << endl;
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+/// <sumary>
+/// Writes the counters in the Prometheus text format, e.g. for the textfile collector of the node exporter.
+/// The file is replaced at once, so a scraper never reads a partly written file.
+/// </sumary>
+/// <returns>False if the file could not be written</returns>
+bool MetricsReader::writePrometheus(string fileName) {
+    if(block == nullptr) return false;
+
+    string temporary_name = fileName + ".tmp";
+    {
+        ofstream outStream(temporary_name, ios::trunc);
+        if(!outStream) return false;
+        outStream.precision(15);
+
+        for(int i = 0; i < (int) Metric::Count; i++) {
+            const MetricDescription& description = METRIC_DESCRIPTIONS[i];
+            outStream << "# HELP " << description.name << " " << description.help << "\n";
+            outStream << "# TYPE " << description.name << " " << description.type << "\n";
+            outStream << description.name << " " << block->values[i].load() << "\n";
+        }
+
+        outStream << "# HELP videoslam_stage_seconds_total Time spent in the stages of the frame loop\n";
+        outStream << "# TYPE videoslam_stage_seconds_total counter\n";
+        for(int i = 0; i < (int) Stage::Count; i++) {
+            outStream << "videoslam_stage_seconds_total{stage=\"" << STAGE_NAMES[i] << "\"} " << block->stage_total[i].load() / 1e9 << "\n";
+        }
+        outStream << "# HELP videoslam_stage_runs_total Number of times the stages of the frame loop ran\n";
+        outStream << "# TYPE videoslam_stage_runs_total counter\n";
+        for(int i = 0; i < (int) Stage::Count; i++) {
+            outStream << "videoslam_stage_runs_total{stage=\"" << STAGE_NAMES[i] << "\"} " << block->stage_count[i].load() << "\n";
+        }
+        outStream << "# HELP videoslam_stage_last_seconds Latency of the stages in the last frame\n";
+        outStream << "# TYPE videoslam_stage_last_seconds gauge\n";
+        for(int i = 0; i < (int) Stage::Count; i++) {
+            outStream << "videoslam_stage_last_seconds{stage=\"" << STAGE_NAMES[i] << "\"} " << block->stage_last[i].load() / 1e9 << "\n";
+        }
+
+        outStream << "# HELP videoslam_start_time_seconds Start of the run, since the epoch\n";
+        outStream << "# TYPE videoslam_start_time_seconds gauge\n";
+        outStream << "videoslam_start_time_seconds " << block->start_time.load() / 1e9 << "\n";
+        outStream << "# HELP videoslam_running Whether the run is still going on\n";
+        outStream << "# TYPE videoslam_running gauge\n";
+        outStream << "videoslam_running " << (block->end_time.load() == 0 ? 1 : 0) << "\n";
+        if(!outStream) return false;
+    }
+
+    remove(fileName.c_str());
+    return rename(temporary_name.c_str(), fileName.c_str()) == 0;
+}
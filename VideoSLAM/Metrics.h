@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// counters are read by other processes straight from the shared memory, so they must not need a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Metrics need lock-free 64-bit atomics");
+
+// the running process exports its metrics in a shared memory segment of this name, followed by its process ID
+static const char METRICS_SEGMENT_PREFIX[] = "VideoSLAM_Metrics_";
+
+enum class Metric {
+    FramesProcessed,
+    FramesDetected,                     // frames with at least one detected marker
+    FramesTracked,                      // frames, in which the markers were tracked instead of detected
+    FramesBlurred,                      // frames skipped before the detection, written as "Blurred"
+    FramesMissing,                      // frames without a valid camera pose, written as "Missing"
+    MarkersDetected,
+    MarkersMapped,
+    OutputBytes,                        // results, detection logs and other files written
+    BundleAdjusterQueue,                // frames waiting for the bundle adjustment
+    LogQueue,                           // log records waiting for the sink
+    Count
+};
+
+// stages of the frame loop, with their latencies
+enum class Stage { Decode, Detection, MapUpdate, Frame, Count };
+
+/// <sumary>
+/// Live counters of the run, in a shared memory segment. The process updates them with relaxed atomics,
+/// which costs no more than an increment, and any number of other processes can read them at any time.
+/// </sumary>
+struct MetricsBlock {
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint64_t> start_time;                           // system clock, nanoseconds since the epoch
+    std::atomic<uint64_t> end_time;                             // 0 while the run is going on
+    std::atomic<uint64_t> values[(int) Metric::Count];
+    std::atomic<uint64_t> stage_total[(int) Stage::Count];      // nanoseconds spent in the stage
+    std::atomic<uint64_t> stage_last[(int) Stage::Count];       // nanoseconds of the last frame
+    std::atomic<uint64_t> stage_count[(int) Stage::Count];
+};
+
+// segment names of this process and of another one
+std::string metricsSegmentName();
+std::string metricsSegmentName(uint64_t process_id);
+
+// exporting process
+bool openMetrics(std::string name = metricsSegmentName());
+void closeMetrics();
+MetricsBlock& metrics();
+uint64_t metricsTime();
+
+inline void addMetric(Metric metric, uint64_t value = 1) {
+    metrics().values[(int) metric].fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void subtractMetric(Metric metric, uint64_t value) {
+    metrics().values[(int) metric].fetch_sub(value, std::memory_order_relaxed);
+}
+
+inline void setMetric(Metric metric, uint64_t value) {
+    metrics().values[(int) metric].store(value, std::memory_order_relaxed);
+}
+
+inline void addStageTime(Stage stage, uint64_t nanoseconds) {
+    MetricsBlock& block = metrics();
+    block.stage_total[(int) stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+    block.stage_last[(int) stage].store(nanoseconds, std::memory_order_relaxed);
+    block.stage_count[(int) stage].fetch_add(1, std::memory_order_relaxed);
+}
+
+// reading process
+class MetricsReader {
+public:
+    // constructors & deconstructors
+    MetricsReader();
+    virtual ~MetricsReader();
+
+    // methods
+    bool open(std::string name);
+    bool isOpen() const { return block != nullptr; }
+    bool isFinished() const { return block != nullptr && block->end_time.load() != 0; }
+    void close();
+    void print(std::ostream& out);
+    bool writePrometheus(std::string fileName);
+
+private:
+    const MetricsBlock* block;
+    void* handle;
+    uint64_t last_frames;
+    uint64_t last_time;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "PreviewRenderer.h"
+
+using namespace std;
+using namespace cv;
+
+/// <sumary>
+/// Opens the preview window on a new renderer thread.
+/// </sumary>
+/// <param name="window_name">Name of the preview window</param>
+/// <param name="refresh_rate">Maximal number of displayed frames per second</param>
+/// <param name="stop_requested">Flag that is set when ESC is pressed in the window</param>
+PreviewRenderer::PreviewRenderer(string window_name, double refresh_rate, atomic<bool>& stop_requested) : stop_requested(stop_requested) {
+    this->window_name = window_name;
+    this->frame_interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / refresh_rate));
+    this->next_frame_time = chrono::steady_clock::now();
+    this->has_pending = false;
+    this->running = true;
+    this->render_thread = thread(&PreviewRenderer::run, this);
+}
+
+PreviewRenderer::~PreviewRenderer() {
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        running = false;
+    }
+    frame_ready.notify_one();
+    render_thread.join();
+}
+
+/// <sumary>
+/// Checks if a submitted frame would be displayed. Frames are dropped while the previous one is still
+/// being drawn or when they come faster than the refresh rate, so they should not be prepared at all.
+/// </sumary>
+bool PreviewRenderer::wantsFrame() {
+    if(chrono::steady_clock::now() < next_frame_time) return false;
+
+    unique_lock<mutex> lock(pending_mutex, try_to_lock);
+    return lock.owns_lock() && !has_pending;
+}
+
+/// <sumary>
+/// Hands a frame and its detections over to the renderer. The frame is shared, not copied, and has to
+/// stay unchanged, so the caller should release it before reading the next frame into it.
+/// Never waits for the renderer, the frame is dropped instead.
+/// </sumary>
+void PreviewRenderer::submit(const Mat& frame, const vector<vector<Point2f>>& corners, const vector<int>& ids,
+                             const vector<Vec3d>& rvecs, const vector<Vec3d>& tvecs, const Mat& cameraMatrix, const Mat& distCoeff) {
+    unique_lock<mutex> lock(pending_mutex, try_to_lock);
+    if(!lock.owns_lock() || has_pending) return;
+
+    pending.frame = frame;
+    pending.corners = corners;
+    pending.ids = ids;
+    pending.rvecs = rvecs;
+    pending.tvecs = tvecs;
+    pending.cameraMatrix = cameraMatrix;
+    pending.distCoeff = distCoeff;
+    has_pending = true;
+    next_frame_time = chrono::steady_clock::now() + frame_interval;
+
+    lock.unlock();
+    frame_ready.notify_one();
+}
+
+void PreviewRenderer::run() {
+    namedWindow(window_name, WINDOW_NORMAL);
+
+    Overlay overlay;
+    Mat canvas;
+    while(true) {
+        bool draw = false;
+        {
+            unique_lock<mutex> lock(pending_mutex);
+            frame_ready.wait_for(lock, chrono::milliseconds(10), [this]() { return has_pending || !running; });
+            if(!running) break;
+
+            if(has_pending) {
+                swap(overlay, pending);
+                has_pending = false;
+                draw = true;
+            }
+        }
+
+        if(draw) {
+            // the frame is shared with the processing thread, draw on a copy
+            overlay.frame.copyTo(canvas);
+            overlay.frame.release();
+            aruco::drawDetectedMarkers(canvas, overlay.corners, overlay.ids);
+            for(size_t i = 0; i < overlay.ids.size(); i++) {
+                aruco::drawAxis(canvas, overlay.cameraMatrix, overlay.distCoeff, overlay.rvecs[i], overlay.tvecs[i], 0.1f);
+            }
+            imshow(window_name, canvas);
+        }
+
+        // keep the window responsive even without new frames
+        if(waitKey(1) == 27) {
+            LOG(Info, Preview, "ESC pressed");
+            stop_requested = true;
+        }
+    }
+
+    destroyWindow(window_name);
+}
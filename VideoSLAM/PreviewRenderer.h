@@ -0,0 +1,47 @@
+#ifndef PREVIEW_RENDERER_H
+#define PREVIEW_RENDERER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+
+// displays frames with their detections on its own thread, dropping frames that come faster than the display rate
+class PreviewRenderer {
+public:
+    // constructors & deconstructors
+    PreviewRenderer(std::string window_name, double refresh_rate, std::atomic<bool>& stop_requested);
+    virtual ~PreviewRenderer();
+
+    // methods
+    bool wantsFrame();
+    void submit(const cv::Mat& frame, const std::vector<std::vector<cv::Point2f>>& corners, const std::vector<int>& ids,
+                const std::vector<cv::Vec3d>& rvecs, const std::vector<cv::Vec3d>& tvecs, const cv::Mat& cameraMatrix, const cv::Mat& distCoeff);
+
+private:
+    // a frame and what to draw on it
+    struct Overlay {
+        cv::Mat frame;
+        std::vector<std::vector<cv::Point2f>> corners;
+        std::vector<int> ids;
+        std::vector<cv::Vec3d> rvecs, tvecs;
+        cv::Mat cameraMatrix, distCoeff;
+    };
+
+    std::string window_name;
+    std::chrono::steady_clock::duration frame_interval;
+    std::chrono::steady_clock::time_point next_frame_time;
+    std::atomic<bool>& stop_requested;
+
+    std::thread render_thread;
+    std::mutex pending_mutex;
+    std::condition_variable frame_ready;
+    Overlay pending;
+    bool has_pending;
+    bool running;
+
+    void run();
+};
+
+#endif
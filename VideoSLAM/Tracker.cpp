@@ -0,0 +1,415 @@
+#include "stdafx.h"
+#include "Tracker.h"
+
+using namespace std;
+using namespace cv;
+
+static const int INIT_MIN_SIZE_VALUE = 1000000;
+
+/// <sumary>
+/// Creates a tracker with its own, empty marker map.
+/// </sumary>
+/// <param name="cameraMatrix">Camera matrix of the calibrated camera</param>
+/// <param name="distCoeff">Distortion coefficients of the calibrated camera</param>
+/// <param name="marker_length">Length of the marker side in meters</param>
+/// <param name="num_of_markers">Maximal number of markers in the map</param>
+/// <param name="parameters">Marker detection parameters</param>
+Tracker::Tracker(const Mat& cameraMatrix, const Mat& distCoeff, float marker_length, int num_of_markers, Ptr<aruco::DetectorParameters> parameters)
+    : Tracker(cameraMatrix, distCoeff, marker_length, make_shared<MarkerMap>(num_of_markers), parameters) {
+}
+
+/// <sumary>
+/// Creates a tracker, that maps the markers into a map shared with other trackers.
+/// </sumary>
+/// <param name="map">Marker map of the rig</param>
+Tracker::Tracker(const Mat& cameraMatrix, const Mat& distCoeff, float marker_length, shared_ptr<MarkerMap> map, Ptr<aruco::DetectorParameters> parameters)
+    : fast_detector(parameters) {
+    this->use_fast_detector = true;
+    this->detection_interval = 1;
+    this->skip_blurred = false;
+    this->frames_since_detection = 0;
+    this->cameraMatrix = cameraMatrix;
+    this->distCoeff = distCoeff;
+    this->marker_length = marker_length;
+    this->parameters = parameters;
+    this->dictionary = aruco::getPredefinedDictionary(DICTIONARY_NAME);
+    this->map = map;
+    this->next_frame_num = 0;
+    this->frames_processed = 0;
+    this->context.map_changed = false;
+    this->context.allocations_start = 0;
+    this->context.allocations = 0;
+
+    // every marker of the dictionary can be visible at once
+    this->context.pose.visible_ids.reserve(FastArucoDetector<DICTIONARY_NAME>::NUM_MARKERS);
+}
+
+Tracker::~Tracker() = default;
+
+/// <sumary>
+/// Sets the function, that is called with the pose of every processed frame, before processFrame returns.
+/// </sumary>
+void Tracker::setPoseCallback(function<void(const FramePose&)> callback) {
+    pose_callback = callback;
+}
+
+/// <sumary>
+/// Starts a sliding-window bundle adjustment of the frames and the map on a background thread.
+/// The frame loop does not wait for it, refined poses are handed to the adjuster's callback.
+/// </sumary>
+/// <param name="window_size">Number of last frames that are adjusted</param>
+void Tracker::enableBundleAdjustment(int window_size) {
+    adjuster = make_shared<BundleAdjuster>(map, marker_length, window_size);
+}
+
+#ifdef COUNT_ALLOCATIONS
+static const int WARMUP_FRAMES = 10;
+#endif
+
+/// <sumary>
+/// Detects the markers in the frame, updates the marker map and computes the camera pose.
+/// The frame is only read and is not used after the method returns.
+/// </sumary>
+/// <param name="frame">Grayscale or BGR frame</param>
+/// <param name="timestamp">Time of the frame, copied to the pose</param>
+/// <param name="frame_num">Number of the frame, -1 to count the frames from 0</param>
+/// <returns>Camera pose in the world frame of the marker map, valid until the next frame is processed</returns>
+const FramePose& Tracker::processFrame(const Mat& frame, double timestamp, int frame_num) {
+    beginFrame(timestamp, frame_num);
+
+    // blurred and badly exposed frames would only give noisy poses, if any markers were found in them
+    uint64_t detection_start = metricsTime();
+    if(skip_blurred && !quality_filter.accept(frame)) {
+        LOG(Debug, Detection, "Frame {}: blurred, sharpness {} of {} on average", context.pose.frame_num, quality_filter.getLastQuality().sharpness, quality_filter.getAverageSharpness());
+        context.pose.blurred = true;
+        context.corners.clear();
+        context.detected_IDs.clear();
+        context.rejects.clear();
+        frames_since_detection = detection_interval;
+        addMetric(Metric::FramesBlurred);
+        addStageTime(Stage::Detection, metricsTime() - detection_start);
+        return finishFrame();
+    }
+
+    // between full detections the corners of the last detected markers are followed
+    bool tracked = false;
+    if(detection_interval > 1 && frames_since_detection < detection_interval) {
+        tracked = corner_tracker.track(frame, context.detected_IDs, context.corners);
+        if(!tracked) LOG(Debug, Detection, "Frame {}: corner tracking lost a marker, detecting again", context.pose.frame_num);
+    }
+
+    if(tracked) {
+        context.rejects.clear();
+        frames_since_detection++;
+        addMetric(Metric::FramesTracked);
+    } else {
+        // detect markers in this frame
+        if(use_fast_detector) {
+            fast_detector.detectMarkers(frame, context.corners, context.detected_IDs, context.rejects);
+        } else {
+            UncountedAllocations library;
+            aruco::detectMarkers(frame, dictionary, context.corners, context.detected_IDs, parameters, context.rejects);
+        }
+        if(detection_interval > 1) corner_tracker.reset(frame, context.detected_IDs, context.corners);
+        frames_since_detection = 1;
+    }
+    addStageTime(Stage::Detection, metricsTime() - detection_start);
+
+#ifdef COUNT_ALLOCATIONS
+    LOG(Debug, Slam, "Frame {}: {} allocations in detection", context.pose.frame_num, threadAllocationCount() - context.allocations_start);
+#endif
+
+    return finishFrame();
+}
+
+/// <sumary>
+/// Updates the marker map and computes the camera pose from detections made earlier, e.g. read from a DetectionLogReader.
+/// </sumary>
+/// <param name="ids">IDs of the detected markers</param>
+/// <param name="corners">Corners of the detected markers, as aruco::detectMarkers returns them</param>
+/// <param name="timestamp">Time of the frame, copied to the pose</param>
+/// <param name="frame_num">Number of the frame, -1 to count the frames from 0</param>
+/// <param name="blurred">The frame was skipped by the quality filter when the detections were made, it gets no pose</param>
+/// <returns>Camera pose in the world frame of the marker map, valid until the next frame is processed</returns>
+const FramePose& Tracker::processDetections(const vector<int>& ids, const vector<vector<Point2f>>& corners, double timestamp, int frame_num, bool blurred) {
+    beginFrame(timestamp, frame_num);
+
+    context.rejects.clear();
+    if(blurred) {
+        context.pose.blurred = true;
+        context.corners.clear();
+        context.detected_IDs.clear();
+        addMetric(Metric::FramesBlurred);
+        return finishFrame();
+    }
+
+    context.detected_IDs = ids;
+    context.corners = corners;
+
+    return finishFrame();
+}
+
+void Tracker::beginFrame(double timestamp, int frame_num) {
+#ifdef COUNT_ALLOCATIONS
+    context.allocations_start = threadAllocationCount();
+#endif
+    if(frame_num < 0) frame_num = next_frame_num;
+    next_frame_num = frame_num + 1;
+
+    // the data of the previous frame is overwritten, keeping the memory
+    context.arena.reset();
+    context.map_changed = false;
+    FramePose& pose = context.pose;
+    pose.frame_num = frame_num;
+    pose.timestamp = timestamp;
+    pose.valid = false;
+    pose.blurred = false;
+    pose.num_detected = 0;
+    pose.closest_marker_id = -1;
+    pose.visible_ids.clear();
+}
+
+// marker poses, map update and camera pose of the detected markers
+const FramePose& Tracker::finishFrame() {
+    FramePose& pose = context.pose;
+    uint64_t update_start = metricsTime();
+
+    // marker pose estimation, it allocates inside of OpenCV
+    {
+        UncountedAllocations library;
+        aruco::estimatePoseSingleMarkers(context.corners, marker_length, cameraMatrix, distCoeff, context.rvecs, context.tvecs);
+    }
+
+#ifdef COUNT_ALLOCATIONS
+    uint64_t allocations_estimation = threadAllocationCount();
+#endif
+
+    updateMap(pose);
+
+#ifdef COUNT_ALLOCATIONS
+    // the map update must not allocate once the buffers are warmed up, the detection only for scenes like the last one
+    uint64_t allocations_update = threadAllocationCount() - allocations_estimation;
+    context.allocations = threadAllocationCount() - context.allocations_start;
+    LOG(Debug, Slam, "Frame {}: {} allocations, {} in the map update", pose.frame_num, context.allocations, allocations_update);
+    if(frames_processed >= WARMUP_FRAMES && allocations_update > 0 && !context.map_changed) {
+        LOG(Warning, Slam, "Frame {}: the map update allocated {} times after the warm-up", pose.frame_num, allocations_update);
+    }
+#endif
+    frames_processed++;
+    addStageTime(Stage::MapUpdate, metricsTime() - update_start);
+    addMetric(Metric::FramesProcessed);
+    addMetric(Metric::MarkersDetected, pose.num_detected);
+    if(pose.num_detected > 0) addMetric(Metric::FramesDetected);
+    if(!pose.valid) addMetric(Metric::FramesMissing);
+
+    if(adjuster && pose.valid) {
+        // corners of the mapped markers, the adjuster works without the camera model
+        context.adjusted_ids.clear();
+        context.normalized_corners.resize(context.detected_IDs.size());
+        for(size_t i = 0; i < context.detected_IDs.size(); i++) {
+            if(context.map_indices[i] == -1) continue;
+            undistortPoints(context.corners[i], context.normalized_corners[context.adjusted_ids.size()], cameraMatrix, distCoeff);
+            context.adjusted_ids.push_back(context.detected_IDs[i]);
+        }
+        context.normalized_corners.resize(context.adjusted_ids.size());
+        adjuster->addFrame(pose, context.adjusted_ids, context.normalized_corners, cameraMatrix.at<double>(0, 0));
+    }
+
+    if(pose_callback) pose_callback(pose);
+    return pose;
+}
+
+/// <sumary>
+/// Processes a frame in a buffer owned by the caller, e.g. a decoder or camera driver. The buffer is wrapped, not copied.
+/// </sumary>
+/// <param name="data">First pixel of the frame</param>
+/// <param name="step">Number of bytes between the starts of two rows</param>
+/// <param name="type">OpenCV type of the pixels, CV_8UC1 or CV_8UC3 (BGR)</param>
+const FramePose& Tracker::processFrame(const uchar* data, int width, int height, size_t step, int type, double timestamp, int frame_num) {
+    const Mat frame(height, width, type, (void*) data, step);
+    return processFrame(frame, timestamp, frame_num);
+}
+
+void Tracker::updateMap(FramePose& pose) {
+    const vector<int>& detected_IDs = context.detected_IDs;
+    vector<int>& map_indices = context.map_indices;
+    size_t num_detected = detected_IDs.size();
+    pose.num_detected = (int) num_detected;
+    map_indices.assign(num_detected, -1);
+    if(num_detected <= 0) {
+        LOG(Debug, Slam, "Frame {}: No Markers detected", pose.frame_num);
+        return;
+    }
+    // markers are detected
+
+    // camera pose based on every detected marker, these are only known to this tracker
+    ArenaVector<MarkerObservation> observations(num_detected, MarkerObservation(), ArenaAllocator<MarkerObservation>(context.arena));
+    for(size_t i = 0; i < num_detected; i++) {
+        observations[i].marker_id = detected_IDs[i];
+        getCameraPoseBasedOnMarker(observations[i], context.rvecs[i], context.tvecs[i]);
+    }
+
+    // handle first detected marker
+    if(map->getMarkerCounter() == 0) {
+        // detect the marker with lowest ID
+        int lowest_i = 0;
+        for(int i = 1; i < num_detected; i++) {
+            if(detected_IDs[i] < detected_IDs[lowest_i]) lowest_i = i;
+        }
+
+        // set it to world's origin, camera position is trivial
+        MarkerInfo origin = toMarkerInfo(observations[lowest_i]);
+        origin.world_position = Vec3d(0, 0, 0);
+        origin.world_orientation_matrix = Mat::eye(3, 3, CV_64F);
+        origin.world_orientation = Quat<double>::createFromRotMat(origin.world_orientation_matrix);
+
+        // relative position equals Global position
+        origin.to_prev_position = Vec3d(0, 0, 0);
+        origin.to_prev_orientation_matrix = Mat::eye(3, 3, CV_64F);
+        origin.to_prev_orientation = Quat<double>::createFromRotMat(origin.to_prev_orientation_matrix);
+
+        // previous marker
+        origin.previous_marker_index = WORLD;
+
+        // another camera might have set the origin in the meantime
+        if(map->setOrigin(origin)) LOG(Info, Slam, "Lowest Id marker: {}", origin.marker_id);
+        context.map_changed = true;
+    }
+
+    // world pose of each detected marker, if it is mapped
+    ArenaVector<MarkerPose> mapped(num_detected, MarkerPose(), ArenaAllocator<MarkerPose>(context.arena));
+    map->lookup(detected_IDs.data(), num_detected, mapped.data(), map_indices.data());
+
+    // the mapped marker, to which new markers are linked, is the one mapped first
+    int reference = -1;
+    for(int i = 0; i < num_detected; i++) {
+        if(map_indices[i] != -1 && (reference == -1 || map_indices[i] < map_indices[reference])) reference = i;
+    }
+
+    for(int i = 0; reference != -1 && i < num_detected; i++) {
+        if(map_indices[i] != -1) {
+            LOG(Trace, Slam, "Found existing marker with ID: {}", detected_IDs[i]);
+            continue;
+        }
+
+        // new marker detected, compute transform between two markers and apply world transform
+        context.map_changed = true;
+        MarkerInfo previous = toMarkerInfo(observations[reference]);
+        previous.world_position = mapped[reference].world_position;
+        previous.world_orientation_matrix = Mat(mapped[reference].world_orientation_matrix);
+
+        MarkerInfo current = toMarkerInfo(observations[i]);
+        current.previous_marker_index = map_indices[reference];
+        computeTransforms(current, previous);
+
+        int index = map->insert(current);
+        if(index == -1) {
+            LOG(Warning, Slam, "No space left for marker with ID: {}", detected_IDs[i]);
+            continue;
+        }
+        mapped[i].previous_marker_index = current.previous_marker_index;
+        mapped[i].world_position = current.world_position;
+        mapped[i].world_orientation_matrix = (Matx33d) current.world_orientation_matrix;
+        map_indices[i] = index;
+        LOG(Debug, Slam, "Detected new marker with ID: {}", detected_IDs[i]);
+    }
+
+    // compute which of the visible markers is the closest to the camera
+    int closest = closestMarker(observations.data(), num_detected);
+
+    // check if closest marker has world position
+    if(closest != -1 && map_indices[closest] != -1) {
+        // compute global camera pose, the inverse of the marker's rotation is its transpose
+        const MarkerPose& marker = mapped[closest];
+        const MarkerObservation& observation = observations[closest];
+        pose.valid = true;
+        pose.closest_marker_id = detected_IDs[closest];
+        pose.position = marker.world_position + marker.world_orientation_matrix.t() * observation.camera_position;
+        pose.orientation_matrix = observation.camera_orientation_matrix * marker.world_orientation_matrix;
+
+        // visible are the mapped markers, in the order of the map
+        ArenaVector<pair<int, int>> visible(ArenaAllocator<pair<int, int>>(context.arena));
+        visible.reserve(num_detected);
+        for(size_t i = 0; i < num_detected; i++) {
+            if(map_indices[i] != -1) visible.push_back(make_pair(map_indices[i], detected_IDs[i]));
+        }
+        sort(visible.begin(), visible.end());
+        for(size_t i = 0; i < visible.size(); i++) pose.visible_ids.push_back(visible[i].second);
+
+        LOG(Debug, Slam, "Frame {}: {}\n{}", pose.frame_num, pose.position, pose.orientation_matrix);
+    } else {
+        LOG(Debug, Slam, "Frame {}: Cannot get accurate cam position", pose.frame_num);
+    }
+}
+
+/// <sumary>
+/// Computes the camera pose in regards to the detected rotation and translation vectors of marker.
+/// </sumary>
+/// <param name="marker">Observation of the marker, to which to write the results</param>
+/// <param name="r_vec">Rotation vector of the marker.</param>
+/// <param name="t_vec">Translation vector of the marker</param>
+void Tracker::getCameraPoseBasedOnMarker(MarkerObservation& marker, Vec3d r_vec, Vec3d t_vec) {
+    Matx33d marker_rotation = rotationExp(r_vec);
+
+    marker.my_position = t_vec;
+    marker.my_orientation_matrix = marker_rotation.t();
+
+    marker.camera_orientation_matrix = marker_rotation;
+    marker.camera_position = marker_rotation.t() * -t_vec;
+}
+
+/// <sumary>
+/// Finds the observed marker closest to the camera, its pose is the most accurate.
+/// </sumary>
+/// <returns>Index of the closest marker, -1 if there are no observations</returns>
+int Tracker::closestMarker(const MarkerObservation* observations, int count) {
+    double minimal_distance = INIT_MIN_SIZE_VALUE;
+    int closest = -1;
+    for(int k = 0; k < count; k++) {
+        double size = norm(observations[k].camera_position);
+        if(size < minimal_distance) {
+            minimal_distance = size;
+            closest = k;
+        }
+    }
+    return closest;
+}
+
+/// <sumary>
+/// Converts the observation into a MarkerInfo, that can be added to the marker map.
+/// </sumary>
+MarkerInfo Tracker::toMarkerInfo(const MarkerObservation& observation) {
+    MarkerInfo marker;
+    marker.marker_id = observation.marker_id;
+    marker.visible = true;
+
+    marker.my_position = observation.my_position;
+    marker.my_orientation_matrix = Mat(observation.my_orientation_matrix);
+    marker.my_orientation = Quat<double>::createFromRotMat(marker.my_orientation_matrix);
+
+    marker.current_camera_pose_position = observation.camera_position;
+    marker.current_camera_pose_orientation_matrix = Mat(observation.camera_orientation_matrix);
+    marker.current_camera_pose_orientation = Quat<double>::createFromRotMat(marker.current_camera_pose_orientation_matrix);
+    return marker;
+}
+
+/// <sumary>
+/// Computes the world pose of the current marker from its pose relative to the previous marker, seen in the same frame.
+/// </sumary>
+void Tracker::computeTransforms(MarkerInfo& current_marker, MarkerInfo& previous_marker) {
+    Vec3d tran_diff = current_marker.my_position - previous_marker.my_position;
+    Vec3d trenutni_v_bazicnem_ks = ((Matx33d) (Mat) previous_marker.my_orientation_matrix.inv().t() * tran_diff); // konec centriranja v koordinatni sistem bazicnega markerja
+
+    Mat current_rot_matrix_v_bazicnem_ks = current_marker.my_orientation_matrix * previous_marker.my_orientation_matrix.inv();
+
+    Vec3d centriran_superb_v_bazicnem_ks = ((Matx33d) (Mat) previous_marker.world_orientation_matrix.inv().t()) * -previous_marker.world_position;// centriran superbazicni v koordinatni sistem bazicnega
+
+    current_marker.world_position = ((Matx33d) (Mat) previous_marker.world_orientation_matrix.t()) * (trenutni_v_bazicnem_ks - centriran_superb_v_bazicnem_ks);
+    current_marker.world_orientation_matrix = (previous_marker.world_orientation_matrix.t() * current_rot_matrix_v_bazicnem_ks.t()).t();
+    current_marker.world_orientation = Quat<double>::createFromRotMat(current_marker.world_orientation_matrix);
+
+    LOG(Debug, Slam, "New marker: {}\n{}", current_marker.world_position, current_marker.world_orientation_matrix);
+
+    // previous_marker.world_orientation_matrix - kako superbaizcen vidi bazicnega
+    // previous_marker.world_position - kako superbaizcen vidi bazicnega
+}
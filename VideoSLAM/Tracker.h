@@ -0,0 +1,145 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+// the tracker can be used outside of this project, so it includes everything it needs
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <opencv2/aruco.hpp>
+#include <opencv2/core/quaternion.hpp>
+
+#include "Log.h"
+#include "MarkerInfo.h"
+#include "MarkerMap.h"
+#include "FrameArena.h"
+#include "FastArucoDetector.h"
+#include "CornerTracker.h"
+#include "FrameQuality.h"
+
+
+class BundleAdjuster;
+
+// dictionary of the used markers
+const cv::aruco::PREDEFINED_DICTIONARY_NAME DICTIONARY_NAME = cv::aruco::DICT_4X4_50;
+
+// camera pose computed for a single frame
+struct FramePose {
+    int frame_num = -1;
+    double timestamp = 0;               // as given to Tracker::processFrame
+    bool valid = false;                 // false if no accurate camera pose was found ("Missing")
+    bool blurred = false;               // skipped before the detection by the quality filter ("Blurred")
+    int num_detected = 0;
+    int closest_marker_id = -1;
+    cv::Vec3d position;
+    cv::Matx33d orientation_matrix;
+    std::vector<int> visible_ids;
+};
+
+// camera pose relative to a detected marker
+struct MarkerObservation {
+    int marker_id;
+    cv::Vec3d my_position;                      // marker in the camera's frame
+    cv::Matx33d my_orientation_matrix;
+    cv::Vec3d camera_position;                  // camera in the marker's frame
+    cv::Matx33d camera_orientation_matrix;
+};
+
+// buffers of the frame loop. They keep their capacity between frames, so a warmed up tracker does not allocate.
+struct FrameContext {
+    FrameArena arena;                           // temporary data of the map update
+    std::vector<std::vector<cv::Point2f>> corners, rejects;
+    std::vector<int> detected_IDs;
+    std::vector<cv::Vec3d> rvecs, tvecs;
+    std::vector<int> map_indices;               // of the detected markers, -1 if not mapped
+    FramePose pose;
+    bool map_changed;                           // a marker was added, which allocates
+    uint64_t allocations_start;                 // thread's allocation count when the frame began
+    uint64_t allocations;                       // by the detection and the map update, outside of library calls. Counted with COUNT_ALLOCATIONS only
+
+    // bundle adjustment
+    std::vector<int> adjusted_ids;
+    std::vector<std::vector<cv::Point2f>> normalized_corners;
+};
+
+// rotation matrix of the rotation vector, as cv::Rodrigues computes it, without temporary matrices
+inline cv::Matx33d rotationExp(const cv::Vec3d& w) {
+    double angle = cv::norm(w);
+    if(angle < 1e-12) return cv::Matx33d::eye();
+
+    cv::Vec3d axis = w * (1.0 / angle);
+    cv::Matx33d K(0, -axis[2], axis[1],
+                  axis[2], 0, -axis[0],
+                  -axis[1], axis[0], 0);
+    return cv::Matx33d::eye() + K * sin(angle) + K * K * (1 - cos(angle));
+}
+
+/// <sumary>
+/// Marker based SLAM on a stream of frames. Every frame is processed in place, the tracker never copies
+/// or keeps it, and the marker map is kept in memory, with the lowest ID marker first seen as the world origin.
+/// Trackers of several cameras can share one marker map, their poses are then in the same world frame.
+/// </sumary>
+class Tracker {
+public:
+    // attributes
+    bool use_fast_detector;             // detect with FastArucoDetector instead of aruco::detectMarkers
+    int detection_interval;             // markers are detected in every n-th frame and their corners tracked in between, 1 to detect in every frame
+    bool skip_blurred;                  // frames rejected by the quality filter skip the detection and the pose estimation
+    FrameQualityFilter quality_filter;
+
+    // constructors & deconstructors
+    Tracker(const cv::Mat& cameraMatrix, const cv::Mat& distCoeff, float marker_length, int num_of_markers,
+            cv::Ptr<cv::aruco::DetectorParameters> parameters = cv::aruco::DetectorParameters::create());
+    Tracker(const cv::Mat& cameraMatrix, const cv::Mat& distCoeff, float marker_length, std::shared_ptr<MarkerMap> map,
+            cv::Ptr<cv::aruco::DetectorParameters> parameters = cv::aruco::DetectorParameters::create());
+    virtual ~Tracker();
+
+    // methods
+    const FramePose& processFrame(const cv::Mat& frame, double timestamp, int frame_num = -1);
+    const FramePose& processFrame(const uchar* data, int width, int height, size_t step, int type, double timestamp, int frame_num = -1);
+    const FramePose& processDetections(const std::vector<int>& ids, const std::vector<std::vector<cv::Point2f>>& corners, double timestamp, int frame_num = -1, bool blurred = false);
+    void setPoseCallback(std::function<void(const FramePose&)> callback);
+    void enableBundleAdjustment(int window_size);
+
+    const std::shared_ptr<MarkerMap>& getMap() const { return map; }
+    const std::shared_ptr<BundleAdjuster>& getBundleAdjuster() const { return adjuster; }
+    std::vector<MarkerInfo> getMarkerMap() const { return map->getMappedMarkers(); }
+    const cv::Mat& getCameraMatrix() const { return cameraMatrix; }
+    const cv::Mat& getDistCoeff() const { return distCoeff; }
+
+    // detections of the last processed frame
+    const std::vector<std::vector<cv::Point2f>>& getLastCorners() const { return context.corners; }
+    const std::vector<int>& getLastIds() const { return context.detected_IDs; }
+    const std::vector<cv::Vec3d>& getLastRvecs() const { return context.rvecs; }
+    const std::vector<cv::Vec3d>& getLastTvecs() const { return context.tvecs; }
+    uint64_t getLastAllocations() const { return context.allocations; }
+
+    static void getCameraPoseBasedOnMarker(MarkerObservation& marker, cv::Vec3d r_vec, cv::Vec3d t_vec);
+    static MarkerInfo toMarkerInfo(const MarkerObservation& observation);
+    static int closestMarker(const MarkerObservation* observations, int count);
+    static void computeTransforms(MarkerInfo& current_marker, MarkerInfo& previous_marker);
+
+private:
+    cv::Mat cameraMatrix, distCoeff;
+    float marker_length;
+    cv::Ptr<cv::aruco::DetectorParameters> parameters;
+    cv::Ptr<cv::aruco::Dictionary> dictionary;
+    FastArucoDetector<DICTIONARY_NAME> fast_detector;
+    CornerTracker corner_tracker;
+    int frames_since_detection;
+    std::function<void(const FramePose&)> pose_callback;
+
+    std::shared_ptr<MarkerMap> map;
+    std::shared_ptr<BundleAdjuster> adjuster;
+    int next_frame_num;
+    long long frames_processed;
+    FrameContext context;
+
+    void beginFrame(double timestamp, int frame_num);
+    const FramePose& finishFrame();
+    void updateMap(FramePose& pose);
+};
+
+#endif
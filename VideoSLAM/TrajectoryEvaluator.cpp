@@ -0,0 +1,306 @@
+#include "stdafx.h"
+#include "TrajectoryEvaluator.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+
+// fewer matched poses do not determine the alignment
+static const int MIN_MATCHED_POSES = 3;
+
+static Matx33d quaternionToMatrix(double x, double y, double z, double w) {
+    return Quat<double>(w, x, y, z).normalize().toRotMat3x3();
+}
+
+static double rotationAngle(const Matx33d& R) {
+    double cosine = (trace(R) - 1) / 2;
+    return acos(min(1.0, max(-1.0, cosine))) * 180 / CV_PI;
+}
+
+static bool byTime(const TrajectoryPose& a, const TrajectoryPose& b) {
+    return a.time < b.time;
+}
+
+/// <sumary>
+/// Reads the camera poses of a results file, as written by the tracker.
+/// </sumary>
+/// <param name="fileName">Results file</param>
+/// <param name="fps">Frame rate of the video, the frame numbers are turned into seconds with it</param>
+/// <param name="trajectory">Read trajectory</param>
+/// <returns>False if the file cannot be read</returns>
+bool readResultsTrajectory(string fileName, double fps, Trajectory& trajectory) {
+    ifstream inStream(fileName);
+    if(!inStream) return false;
+
+    trajectory = Trajectory();
+    string line, value;
+    while(getline(inStream, line)) {
+        if(line.compare(0, 13, "MaxNumMarkers") == 0) break;  // marker map follows
+        if(line.empty()) continue;
+
+        trajectory.frame_count++;
+        if(line.compare(0, 6, "Frame,") != 0) {
+            trajectory.missing_count++;
+            continue;
+        }
+
+        // Frame, frame number, detected, closest marker, position, orientation quaternion, visible markers
+        stringstream stream(line);
+        double values[11];
+        for(int i = 0; i < 11; i++) {
+            getline(stream, value, ',');
+            values[i] = i == 0 ? 0 : atof(value.c_str());
+        }
+
+        TrajectoryPose pose;
+        pose.time = values[1] / fps;
+        pose.position = Vec3d(values[4], values[5], values[6]);
+        // the tracker writes the world to camera rotation, the evaluation works with camera to world as TUM does
+        pose.orientation = quaternionToMatrix(values[7], values[8], values[9], values[10]).t();
+        trajectory.poses.push_back(pose);
+    }
+
+    // segments are written in order, but merged results need not be
+    if(!is_sorted(trajectory.poses.begin(), trajectory.poses.end(), byTime)) {
+        sort(trajectory.poses.begin(), trajectory.poses.end(), byTime);
+    }
+    return true;
+}
+
+/// <sumary>
+/// Reads a reference trajectory, either a results file or a text file with a pose per line in the TUM format:
+/// time in seconds from the start of the video, position and orientation quaternion "t x y z qx qy qz qw".
+/// </sumary>
+/// <param name="fileName">Reference file</param>
+/// <param name="fps">Frame rate of the video, used for results files</param>
+/// <param name="trajectory">Read trajectory</param>
+/// <returns>False if the file cannot be read</returns>
+bool readReferenceTrajectory(string fileName, double fps, Trajectory& trajectory) {
+    ifstream inStream(fileName);
+    if(!inStream) return false;
+
+    string line;
+    while(getline(inStream, line) && (line.empty() || line[0] == '#'));
+    if(line.compare(0, 6, "Frame,") == 0 || line == "Missing" || line == "Blurred") {
+        inStream.close();
+        return readResultsTrajectory(fileName, fps, trajectory);
+    }
+
+    trajectory = Trajectory();
+    do {
+        if(line.empty() || line[0] == '#') continue;
+
+        stringstream stream(line);
+        double t, x, y, z, qx, qy, qz, qw;
+        if(!(stream >> t >> x >> y >> z >> qx >> qy >> qz >> qw)) {
+            LOG(Warning, Main, "Skipping a malformed line of the reference trajectory: {}", line);
+            continue;
+        }
+
+        TrajectoryPose pose;
+        pose.time = t;
+        pose.position = Vec3d(x, y, z);
+        pose.orientation = quaternionToMatrix(qx, qy, qz, qw);
+        trajectory.poses.push_back(pose);
+        trajectory.frame_count++;
+    } while(getline(inStream, line));
+
+    sort(trajectory.poses.begin(), trajectory.poses.end(), byTime);
+    return true;
+}
+
+/// <sumary>
+/// Creates an evaluator with the usual settings: rigid alignment and relative errors over 0.1, 1 and 10 seconds.
+/// </sumary>
+/// <param name="reference">Trajectory the runs are compared against</param>
+/// <param name="fps">Frame rate of the reference video</param>
+TrajectoryEvaluator::TrajectoryEvaluator(const Trajectory& reference, double fps) {
+    this->reference = reference;
+    this->fps = fps;
+    this->max_time_difference = 0.5 / fps;
+    this->estimate_scale = false;
+    this->rpe_deltas = {0.1, 1, 10};
+}
+
+TrajectoryEvaluator::~TrajectoryEvaluator() = default;
+
+/// <sumary>
+/// Evaluates a single run.
+/// </sumary>
+/// <param name="run">Name of the run in the summary</param>
+/// <param name="estimate">Trajectory of the run</param>
+/// <returns>Errors of the run, not valid if too few of its poses match the reference</returns>
+TrajectoryEvaluation TrajectoryEvaluator::evaluate(string run, const Trajectory& estimate) const {
+    uint64_t start = metricsTime();
+    TrajectoryEvaluation evaluation;
+    evaluation.run = run;
+    evaluation.frame_count = estimate.frame_count;
+    evaluation.missing_count = estimate.missing_count;
+    evaluation.missing_rate = estimate.frame_count > 0 ? (double) estimate.missing_count / estimate.frame_count : 0;
+
+    // both trajectories are sorted, so a single pass pairs every estimated pose with the closest reference pose
+    const vector<TrajectoryPose>& ref = reference.poses;
+    vector<pair<int, int>> matches;
+    size_t j = 0;
+    for(size_t i = 0; i < estimate.poses.size() && !ref.empty(); i++) {
+        double time = estimate.poses[i].time;
+        while(j + 1 < ref.size() && ref[j + 1].time <= time) j++;
+        size_t closest = j;
+        if(j + 1 < ref.size() && ref[j + 1].time - time < abs(time - ref[j].time)) closest = j + 1;
+        if(abs(ref[closest].time - time) <= max_time_difference) matches.push_back(make_pair((int) i, (int) closest));
+    }
+    evaluation.matched_count = (int) matches.size();
+    int n = (int) matches.size();
+    if(n < MIN_MATCHED_POSES) {
+        evaluation.evaluation_ms = (metricsTime() - start) / 1e6;
+        return evaluation;
+    }
+
+    // Umeyama alignment of the estimated positions to the reference positions
+    Vec3d estimate_mean, reference_mean;
+    for(int k = 0; k < n; k++) {
+        estimate_mean += estimate.poses[matches[k].first].position;
+        reference_mean += ref[matches[k].second].position;
+    }
+    estimate_mean /= n;
+    reference_mean /= n;
+
+    Matx33d covariance;
+    double estimate_variance = 0;
+    for(int k = 0; k < n; k++) {
+        Vec3d e = estimate.poses[matches[k].first].position - estimate_mean;
+        Vec3d r = ref[matches[k].second].position - reference_mean;
+        covariance += r * e.t();
+        estimate_variance += e.dot(e);
+    }
+    covariance *= 1.0 / n;
+    estimate_variance /= n;
+
+    Matx31d singular_values;
+    Matx33d U, Vt;
+    SVD::compute(covariance, singular_values, U, Vt);
+    Matx33d S = Matx33d::eye();
+    if(determinant(U) * determinant(Vt) < 0) S(2, 2) = -1;
+    Matx33d R = U * S * Vt;
+    double scale = 1;
+    if(estimate_scale && estimate_variance > 0) {
+        scale = (singular_values(0) * S(0, 0) + singular_values(1) * S(1, 1) + singular_values(2) * S(2, 2)) / estimate_variance;
+    }
+    Vec3d t = reference_mean - scale * (R * estimate_mean);
+    evaluation.scale = scale;
+
+    // absolute trajectory error
+    vector<double> errors(n);
+    double square_sum = 0, sum = 0;
+    for(int k = 0; k < n; k++) {
+        Vec3d aligned = scale * (R * estimate.poses[matches[k].first].position) + t;
+        errors[k] = norm(aligned - ref[matches[k].second].position);
+        square_sum += errors[k] * errors[k];
+        sum += errors[k];
+        evaluation.ate_max = max(evaluation.ate_max, errors[k]);
+    }
+    evaluation.ate_rmse = sqrt(square_sum / n);
+    evaluation.ate_mean = sum / n;
+    nth_element(errors.begin(), errors.begin() + n / 2, errors.end());
+    evaluation.ate_median = errors[n / 2];
+
+    // relative pose error, the pair partner is found with a second pointer running along the matches
+    for(size_t d = 0; d < rpe_deltas.size(); d++) {
+        RelativeError rpe;
+        rpe.delta = rpe_deltas[d];
+        double translation_sum = 0, rotation_sum = 0;
+        int partner = 0;
+        for(int k = 0; k < n; k++) {
+            const TrajectoryPose& e0 = estimate.poses[matches[k].first];
+            double target = e0.time + rpe.delta;
+            if(partner <= k) partner = k + 1;
+            while(partner < n && estimate.poses[matches[partner].first].time < target - max_time_difference) partner++;
+            if(partner >= n) break;
+            const TrajectoryPose& e1 = estimate.poses[matches[partner].first];
+            if(e1.time > target + max_time_difference) continue;  // frames around the target are missing
+
+            const TrajectoryPose& r0 = ref[matches[k].second];
+            const TrajectoryPose& r1 = ref[matches[partner].second];
+            Matx33d estimate_rotation = e0.orientation.t() * e1.orientation;
+            Vec3d estimate_translation = scale * (e0.orientation.t() * (e1.position - e0.position));
+            Matx33d reference_rotation = r0.orientation.t() * r1.orientation;
+            Vec3d reference_translation = r0.orientation.t() * (r1.position - r0.position);
+
+            // error of the estimated relative motion, expressed in the reference's relative frame
+            Vec3d translation_error = reference_rotation.t() * (estimate_translation - reference_translation);
+            double rotation_error = rotationAngle(reference_rotation.t() * estimate_rotation);
+            translation_sum += translation_error.dot(translation_error);
+            rotation_sum += rotation_error * rotation_error;
+            rpe.count++;
+        }
+        if(rpe.count > 0) {
+            rpe.translation_rmse = sqrt(translation_sum / rpe.count);
+            rpe.rotation_rmse = sqrt(rotation_sum / rpe.count);
+        }
+        evaluation.rpe.push_back(rpe);
+    }
+
+    evaluation.valid = true;
+    evaluation.evaluation_ms = (metricsTime() - start) / 1e6;
+    return evaluation;
+}
+
+/// <sumary>
+/// Reads and evaluates the results of many runs in parallel.
+/// </sumary>
+/// <param name="result_files">Results files of the runs</param>
+/// <param name="frame_rates">Frame rate of every run, the frame numbers of its results are turned into seconds with it</param>
+/// <returns>Errors of every run, in the order of the files</returns>
+vector<TrajectoryEvaluation> TrajectoryEvaluator::evaluateRuns(const vector<string>& result_files, const vector<double>& frame_rates) const {
+    vector<TrajectoryEvaluation> evaluations(result_files.size());
+    parallel_for_(Range(0, (int) result_files.size()), [&](const Range& range) {
+        Trajectory estimate;
+        for(int i = range.start; i < range.end; i++) {
+            if(!readResultsTrajectory(result_files[i], frame_rates[i], estimate)) {
+                LOG(Warning, Main, "Could not read the results {}", result_files[i]);
+                evaluations[i].run = result_files[i];
+                continue;
+            }
+            evaluations[i] = evaluate(result_files[i], estimate);
+        }
+    });
+    return evaluations;
+}
+
+/// <sumary>
+/// Writes one line of errors per run into a CSV file.
+/// </sumary>
+/// <param name="fileName">Summary file</param>
+/// <param name="evaluations">Errors of the runs, all with the same relative error deltas</param>
+/// <returns>False if the file cannot be written</returns>
+bool TrajectoryEvaluator::writeSummary(string fileName, const vector<TrajectoryEvaluation>& evaluations) {
+    ofstream outStream(fileName);
+    if(!outStream) return false;
+
+    vector<double> deltas;
+    for(size_t i = 0; i < evaluations.size() && deltas.empty(); i++) {
+        for(size_t d = 0; d < evaluations[i].rpe.size(); d++) deltas.push_back(evaluations[i].rpe[d].delta);
+    }
+
+    outStream << "run,valid,frames,missing,missing_rate,matched,scale,ate_rmse_m,ate_mean_m,ate_median_m,ate_max_m";
+    for(size_t d = 0; d < deltas.size(); d++) {
+        outStream << ",rpe_" << deltas[d] << "s_pairs,rpe_" << deltas[d] << "s_translation_m,rpe_" << deltas[d] << "s_rotation_deg";
+    }
+    outStream << ",evaluation_ms\n";
+
+    outStream << setprecision(6);
+    for(size_t i = 0; i < evaluations.size(); i++) {
+        const TrajectoryEvaluation& e = evaluations[i];
+        outStream << e.run << "," << e.valid << "," << e.frame_count << "," << e.missing_count << "," << e.missing_rate << ","
+                  << e.matched_count << "," << e.scale << "," << e.ate_rmse << "," << e.ate_mean << "," << e.ate_median << "," << e.ate_max;
+        for(size_t d = 0; d < deltas.size(); d++) {
+            if(d < e.rpe.size()) outStream << "," << e.rpe[d].count << "," << e.rpe[d].translation_rmse << "," << e.rpe[d].rotation_rmse;
+            else outStream << ",0,,";
+        }
+        outStream << "," << e.evaluation_ms << "\n";
+    }
+    return (bool) outStream;
+}
@@ -0,0 +1,76 @@
+#ifndef TRAJECTORY_EVALUATOR_H
+#define TRAJECTORY_EVALUATOR_H
+
+#include <string>
+#include <vector>
+
+
+// camera pose at a time, in seconds from the start of the video
+struct TrajectoryPose {
+    double time = 0;
+    cv::Vec3d position;
+    cv::Matx33d orientation;            // camera to world
+};
+
+struct Trajectory {
+    std::vector<TrajectoryPose> poses;  // sorted by time
+    int frame_count = 0;                // frames of the run, with and without a pose
+    int missing_count = 0;              // frames without a pose, "Missing" and "Blurred" as counted by the FramesMissing metric
+};
+
+bool readResultsTrajectory(std::string fileName, double fps, Trajectory& trajectory);
+bool readReferenceTrajectory(std::string fileName, double fps, Trajectory& trajectory);
+
+// relative pose error over a time difference
+struct RelativeError {
+    double delta = 0;                   // seconds
+    int count = 0;                      // pose pairs compared
+    double translation_rmse = 0;        // meters
+    double rotation_rmse = 0;           // degrees
+};
+
+// accuracy of one run against the reference
+struct TrajectoryEvaluation {
+    std::string run;
+    bool valid = false;                 // false if the results could not be read or too few poses matched the reference
+    int frame_count = 0;
+    int missing_count = 0;
+    int matched_count = 0;              // poses matched to a reference pose
+    double missing_rate = 0;
+    double scale = 1;                   // of the alignment, 1 unless the scale is estimated
+    double ate_rmse = 0;                // absolute trajectory error after the alignment, meters
+    double ate_mean = 0;
+    double ate_median = 0;
+    double ate_max = 0;
+    std::vector<RelativeError> rpe;
+    double evaluation_ms = 0;           // time spent on the run, measured with the clock of the stage metrics
+};
+
+/// <sumary>
+/// Compares the trajectories of many runs against a reference trajectory. Poses are matched by time with a single
+/// linear merge of both sorted trajectories, the estimate is aligned to the reference with Umeyama's method and
+/// the absolute and relative pose errors are computed. Runs are evaluated in parallel.
+/// </sumary>
+class TrajectoryEvaluator {
+public:
+    // attributes
+    double fps;                         // frame rate of the reference video, poses are matched within half of its frame time
+    double max_time_difference;         // seconds, poses farther in time from any reference pose are not matched
+    bool estimate_scale;                // align with a similarity instead of a rigid transformation
+    std::vector<double> rpe_deltas;     // time differences of the relative pose errors, in seconds
+
+    // constructors & deconstructors
+    TrajectoryEvaluator(const Trajectory& reference, double fps);
+    virtual ~TrajectoryEvaluator();
+
+    // methods
+    TrajectoryEvaluation evaluate(std::string run, const Trajectory& estimate) const;
+    std::vector<TrajectoryEvaluation> evaluateRuns(const std::vector<std::string>& result_files, const std::vector<double>& frame_rates) const;
+
+    static bool writeSummary(std::string fileName, const std::vector<TrajectoryEvaluation>& evaluations);
+
+private:
+    Trajectory reference;
+};
+
+#endif
@@ -2,24 +2,47 @@
 
 #include "stdafx.h"
 
+// Windows only
+#include "targetver.h"
+#include <tchar.h>
+#include <direct.h>
+
 #define SAVEFRAME_PATH "DeconVid/"  // WARNING: be careful of what you write in here :3
 
 // INPUT
 #define VIDEO_PATH "InputVideos/SF_Video_5.mp4"
 #define SENSOR_DATA_FILE_PATH "InputVideos/SF_Data_5.txt"
+#define CALIBRATION_VIDEO_PATH "Calibration/calibration.mp4"    // the numbered calibration images are used if it is missing
 
 // OUTPUT
 #define RESULTS_FILE_PATH "Results/Ground_Truth_Data.csv"
 #define REWRITTEN_IMU_DATA_FILE_PATH "Results/IMU_Data.txt"
 #define OUTPUT_VIDEO_PATH "Results/Used_Video.mp4"
+#define DETECTION_LOG_PATH "Results/Detections.bin"
+
+// DETECTION
+#define USE_FAST_DETECTOR true  // detect markers with the detector specialized for DICTIONARY_NAME instead of aruco::detectMarkers
+#define DETECTION_INTERVAL 1    // markers are detected in every n-th processed frame and their corners tracked in between
+#define BLUR_RATE 0             // frames less sharp than this fraction of the recent frames skip the detection, 0 to process every frame
+#define DETECTOR_PARAMETERS_PATH "Calibration/detector_parameters.yml"  // written by the detector tuning, defaults if missing
+
+// DECODING
+#define KEY_FRAME_INTERVAL 250  // of the input videos (x264 default); only gaps longer than this are sought over, shorter ones are grabbed
+#define FRAME_CACHE_PATH "Cache/"   // decoded frames of earlier runs, see FrameCache
 
 using namespace std;
 using namespace cv;
 
 // constants
-const Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_4X4_50);
-static const int WORLD = -2;
-static const int INIT_MIN_SIZE_VALUE = 1000000;
+const Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(DICTIONARY_NAME);
+
+// a camera of the rig, the videos of all cameras have to start at the same time
+struct CameraInput {
+    string video_path;
+    string calibration_file;
+    string results_file;
+    string detection_log_file;
+};
 
 // functions
 /// <sumary>
@@ -35,35 +58,10 @@ void generateArucoMarkers(int num_of_markers) {
 
         string file_name = format("MarkerImages/Marker_%03d.png", i);
         bool created = imwrite(file_name, markerImage);
-        cout << file_name << " created: " << created << endl;
+        LOG(Debug, Main, "{} created: {}", file_name, created);
     }
 }
 
-/// <sumary>
-/// Computes the camera pose in regards to the detected rotation and translation vectors of marker and writes it
-/// to MarkerInfo.
-/// </sumary>
-/// <param name="marker">MarkerInfo of the marker, to which to write the results</param>
-/// <param name="r_vec">Rotation vector of the marker.</param>
-/// <param name="t_vec">Translation vector of the marker</param>
-void getCameraPoseBasedOnMarker(MarkerInfo& marker, Vec3d r_vec, Vec3d t_vec) {
-    Mat marker_rotation(3, 3, CV_64FC1);
-    Rodrigues(r_vec, marker_rotation);
-
-    // set to MarkerInfo
-    marker.my_position = t_vec;
-    marker.my_orientation_matrix = marker_rotation.t();
-    // cout << marker.my_orientation_matrix << endl;
-    marker.my_orientation = Quat<double>::createFromRotMat(marker.my_orientation_matrix);
-    // cout << marker.my_orientation << endl;
-
-    marker.current_camera_pose_orientation_matrix = marker.my_orientation_matrix.inv();
-    marker.current_camera_pose_orientation = Quat<double>::createFromRotMat(marker.current_camera_pose_orientation_matrix);
-    // cout << marker.current_camera_pose_orientation << endl;
-    marker.current_camera_pose_position = ((cv::Matx33d) marker.current_camera_pose_orientation_matrix).t() * -t_vec;
-    // cout << marker.current_camera_pose_position << endl;
-}
-
 /// <sumary>
 /// Performs a transform inversion on the marker's camera_pose_position and orientation.
 /// </sumary>
@@ -74,7 +72,7 @@ void markerPoseInverseDEPRICATED(MarkerInfo& marker) {
     // marker.current_camera_pose_orientation = inv(marker.current_camera_pose_orientation);
     marker.current_camera_pose_orientation_matrix = marker.current_camera_pose_orientation_matrix.inv();
     marker.current_camera_pose_orientation = Quat<double>::createFromRotMat(marker.current_camera_pose_orientation_matrix);
-    cout << marker.current_camera_pose_orientation.toEulerAngles(QuatEnum::INT_ZYX) << endl;
+    LOG(Debug, Slam, "{}", marker.current_camera_pose_orientation.toEulerAngles(QuatEnum::INT_ZYX));
 
     // translation inverse
     auto marker_translation = marker.current_camera_pose_orientation.toRotMat3x3() * -marker.current_camera_pose_position;
@@ -85,340 +83,475 @@ void markerPoseInverseDEPRICATED(MarkerInfo& marker) {
     marker.current_camera_pose_position = marker_translation;
 }
 
-void readCalibrationData(ifstream& inputFile, Mat& cameraMatrix, Mat& distCoeff) {
-    cameraMatrix = Mat::eye(3, 3, CV_64F);
-    distCoeff = Mat::zeros(5, 1, CV_64F);
-
-    // camera matrix
-    for(int r = 0; r < cameraMatrix.rows; r++) {
-        for(int c = 0; c < cameraMatrix.cols; c++) {
-            inputFile >> cameraMatrix.at<double>(r, c);
-        }
+/// <sumary>
+/// Reads the calibration of a camera. If there is none, the camera is calibrated with the calibration video,
+/// or with the images in the calibration folder if there is no video.
+/// </sumary>
+/// <param name="calibration_data_file_name">Calibration file of the camera</param>
+/// <param name="calibrate">Should the camera be calibrated when the file cannot be read</param>
+/// <param name="calibration">Read calibration</param>
+/// <returns>False if there is no valid calibration</returns>
+bool loadCalibration(string calibration_data_file_name, bool calibrate, CalibrationData& calibration) {
+    if(CamCalib::readCalibrationData(calibration_data_file_name, calibration)) return true;
+
+    // no valid calibration file has been found
+    LOG(Warning, Calibration, "Could not read calibration file {}", calibration_data_file_name);
+    if(!calibrate) return false;
+
+    LOG(Info, Calibration, "Initiating calibration:");
+    CamCalib cameraCalibration;
+    if(experimental::filesystem::exists(CALIBRATION_VIDEO_PATH)) {
+        cameraCalibration.calibrateFromVideo(calibration_data_file_name, CALIBRATION_VIDEO_PATH, false);
+    } else {
+        // images that were already searched for the grid are not searched again
+        cameraCalibration.myCalibrateCamera(calibration_data_file_name, false);
     }
 
-    // distance coefficients
-    for(int r = 0; r < distCoeff.rows; r++) {
-        inputFile >> distCoeff.at<double>(r, 0);
+    // try reading again
+    if(!CamCalib::readCalibrationData(calibration_data_file_name, calibration)) {
+        LOG(Error, Calibration, "Could not read calibration file after calibration");
+        return false;
     }
+    return true;
 }
 
-void computeTransforms(MarkerInfo& current_marker, MarkerInfo& previous_marker) {
-    cout << endl;
-    Vec3d tran_diff = current_marker.my_position - previous_marker.my_position;
-    // cout << "tran_diff: " << tran_diff << endl;
-    Vec3d trenutni_v_bazicnem_ks = ((Matx33d) (Mat) previous_marker.my_orientation_matrix.inv().t() * tran_diff); // konec centriranja v koordinatni sistem bazicnega markerja
-    // cout << "trenutni_v_bazicnem_ks: " << trenutni_v_bazicnem_ks << endl;
-    
-    // cout << "previous_marker.my_orientation_matrix: " << endl << previous_marker.my_orientation_matrix << endl;
-    // cout << "previous_marker.current_camera_pose_orientation_matrix: " << endl << previous_marker.current_camera_pose_orientation_matrix << endl;
-    // cout << "current_marker.my_orientation_matrix: " << endl << current_marker.my_orientation_matrix << endl;
-    // Mat current_rot_matrix_v_bazicnem_ks = previous_marker.my_orientation_matrix.inv() * current_marker.my_orientation_matrix;
-    // Mat current_rot_matrix_v_bazicnem_ks = (previous_marker.my_orientation_matrix.inv().t() * current_marker.my_orientation_matrix).t();
-    Mat current_rot_matrix_v_bazicnem_ks = current_marker.my_orientation_matrix * previous_marker.my_orientation_matrix.inv();
-    // cout << "current_rot_matrix_v_bazicnem_ks: " << endl << current_rot_matrix_v_bazicnem_ks << endl << endl;
-
-    Vec3d centriran_superb_v_bazicnem_ks = ((Matx33d) (Mat) previous_marker.world_orientation_matrix.inv().t()) * -previous_marker.world_position;// centriran superbazicni v koordinatni sistem bazicnega
-    // cout << "centriran_superb_v_bazicnem_ks: " << endl << centriran_superb_v_bazicnem_ks << endl << endl;
-
-    // cout << "previous_marker.world_orientation_matrix: " << endl << previous_marker.world_orientation_matrix << endl;
-    // trenutni_v_bazicnem_ks = trenutni_v_bazicnem_ks - centriran_superb_v_bazicnem_ks;
-    // current_marker.world_position = ((Matx33d) (Mat) previous_marker.world_orientation_matrix) * trenutni_v_bazicnem_ks;
-    current_marker.world_position = ((Matx33d) (Mat) previous_marker.world_orientation_matrix.t()) * (trenutni_v_bazicnem_ks - centriran_superb_v_bazicnem_ks);
-    // current_marker.world_orientation_matrix = previous_marker.world_orientation_matrix * current_rot_matrix_v_bazicnem_ks;
-    current_marker.world_orientation_matrix = (previous_marker.world_orientation_matrix.t() * current_rot_matrix_v_bazicnem_ks.t()).t();
-    // current_marker.world_orientation_matrix = (previous_marker.world_orientation_matrix * current_rot_matrix_v_bazicnem_ks).inv();
-    current_marker.world_orientation = Quat<double>::createFromRotMat(current_marker.world_orientation_matrix);
-
-    cout << "New marker: " << current_marker.world_position << endl << current_marker.world_orientation_matrix << endl << endl;
-
-    // previous_marker.world_orientation_matrix - kako superbaizcen vidi bazicnega
-    // previous_marker.world_position - kako superbaizcen vidi bazicnega
-
-    /*
-    // world transform
-    current_marker.world_position = ((Matx33d) rot_diff_matrix) * tran_diff + previous_marker.world_position;
-    current_marker.world_orientation_matrix = rot_diff_matrix * current_marker.current_camera_pose_orientation_matrix;
-    current_marker.world_orientation = Quat<double>::createFromRotMat(current_marker.world_orientation_matrix);
+// camera poses refined by the bundle adjustment, collected on the adjuster thread
+struct RefinedPoses {
+    mutex refined_mutex;
+    std::map<int, FramePose> poses;
+};
 
+/// <sumary>
+/// Enables the bundle adjustment of the tracker and collects the refined poses.
+/// </sumary>
+/// <param name="ba_window_size">Number of frames in the sliding-window bundle adjustment, 0 for none</param>
+void collectRefinedPoses(Tracker& tracker, int ba_window_size, RefinedPoses& refined) {
+    if(ba_window_size <= 1) return;
+
+    tracker.enableBundleAdjustment(ba_window_size);
+    tracker.getBundleAdjuster()->setRefinedPoseCallback([&refined](const FramePose& pose) {
+        lock_guard<mutex> lock(refined.refined_mutex);
+        refined.poses[pose.frame_num] = pose;
+    });
+}
 
-    // transform to previous marker
-    current_marker.to_prev_position = previous_marker.world_position - current_marker.world_position;
-    current_marker.to_prev_orientation_matrix = previous_marker.world_orientation_matrix * current_marker.world_orientation_matrix.inv();
-    current_marker.to_prev_orientation = Quat<double>::createFromRotMat(current_marker.to_prev_orientation_matrix);
-    */
- }
-
-int rewriteIMUfile(string imu_data_file, long* start_sec, long* start_nano) {
-    fstream imuFile;
-    imuFile.open(imu_data_file);
-    if(imuFile.fail()) {
-        cerr << "Could not read IMU data file: " + imu_data_file << endl;
-        return -4;
-    }
-
-    string line;
-    if(!getline(imuFile, line)) {
-        cerr << "Wrong IMU file format" << endl;
-        return -5;
-    }
-    string nanosec = line.substr(line.size() - 9, 9);
-    string sec = line.substr(12, line.size() - 9 - 12);
-
-    *start_nano = stol(nanosec);
-    *start_sec = stol(sec);
-
-    // 1. create data.csv
-    ofstream outStream(REWRITTEN_IMU_DATA_FILE_PATH);
-    if(outStream) {
-        // 2. write the comment line
-        outStream << "#timestamp [ns],w_RS_S_x [rad s^-1],w_RS_S_y [rad s^-1],w_RS_S_z [rad s^-1],a_RS_S_x [m s^-2],a_RS_S_y [m s^-2],a_RS_S_z [m s^-2]" << endl;
-        
-        // 3. copy data line by line into memory:
-        // use three queues, one for strings, two for floats
-        queue<string> timestamps;
-        queue<string> gyr_data;
-        queue<string> acc_data;
-        for(int i = 0; getline(imuFile, line); i++) {
-            // check first string
-            stringstream stream(line);
-            string s;
-            getline(stream, s, ' ');
-            
-            if(s.compare("VIDEO_STOP") == 0) break;  // end of data
-
-            string sys_time_data, event_time_data;
-            getline(stream, sys_time_data, ' ');
-            getline(stream, event_time_data, ' ');
-
-            
-            if(s.compare("A") == 0) {
-                for(int j = 0; j < 3; j++) {
-                    getline(stream, s, ' ');
-                    acc_data.push(s);
-                }
-            } else if(s.compare("G") == 0) {
-                for(int j = 0; j < 3; j++) {
-                    getline(stream, s, ' ');
-                    gyr_data.push(s);
-                }
-            } else if(s.compare("M") == 0) {
-                // Magnetometer: TODO
-                continue;
-            } else {
-                // end of data
-                break;
-            }
+/// <sumary>
+/// Waits for the bundle adjustment to finish and replaces the poses of the segment with their last refinement.
+/// </sumary>
+void applyRefinedPoses(Tracker& tracker, VideoSegment& segment, RefinedPoses& refined) {
+    if(!tracker.getBundleAdjuster()) return;
+
+    tracker.getBundleAdjuster()->finish();
+    lock_guard<mutex> lock(refined.refined_mutex);
+    for(size_t i = 0; i < segment.poses.size(); i++) {
+        auto pose = refined.poses.find(segment.poses[i].frame_num);
+        if(pose != refined.poses.end()) segment.poses[i] = pose->second;
+    }
+    LOG(Info, Slam, "{} camera poses refined by bundle adjustment", refined.poses.size());
+}
 
-            // 4. write data line by line into file
-            if(acc_data.size() > 0 && gyr_data.size() > 0) {
-                // data is ready, dont remember time
-                outStream << timestamps.front();
-                timestamps.pop();
+/// <sumary>
+/// Searches the detector parameters on frames spread over the video and saves the fastest ones,
+/// that still find enough of the markers the thorough reference parameters find.
+/// </sumary>
+/// <param name="cap">Opened video</param>
+/// <param name="num_frames">Number of sample frames</param>
+/// <param name="num_candidates">Number of parameter sets tried</param>
+/// <param name="min_recall">Lowest acceptable fraction of the reference detections</param>
+/// <param name="parameters_file">File, to which the chosen parameters are written</param>
+/// <returns>False if no frames could be read or no parameters reach the recall</returns>
+bool tuneDetector(VideoCapture& cap, int num_frames, int num_candidates, double min_recall, string parameters_file) {
+    int frame_count = (int) cap.get(CAP_PROP_FRAME_COUNT);
+    vector<Mat> frames;
+    Mat frame;
+    for(int i = 0; i < num_frames && frame_count > 0; i++) {
+        cap.set(CAP_PROP_POS_FRAMES, (int) ((long long) frame_count * i / num_frames));
+        if(cap.read(frame)) frames.push_back(frame.clone());
+    }
+    if(frames.empty()) {
+        LOG(Error, Detection, "No frames to tune the detector on");
+        return false;
+    }
 
-                for(int j = 0; j < 3; j++) {
-                    outStream << "," << gyr_data.front();
-                    gyr_data.pop();
-                }
-                for(int j = 0; j < 3; j++) {
-                    outStream << "," << acc_data.front();
-                    acc_data.pop();
-                }
+    DetectorTuner tuner(frames, USE_FAST_DETECTOR);
+    LOG(Info, Detection, "Tuning on {} frames with {} reference detections", frames.size(), tuner.getReferenceCount());
+
+    vector<TuningResult> frontier = DetectorTuner::paretoFrontier(tuner.evaluate(DetectorTuner::sampleCandidates(num_candidates, 1)));
+    const TuningResult* chosen = nullptr;
+    for(size_t i = 0; i < frontier.size(); i++) {
+        const TuningResult& result = frontier[i];
+        LOG(Info, Detection, "{} ms, recall {}, {} false, corner error {} px: window {}-{} step {}, perimeter {}-{}, approximation {}, refinement {}",
+            result.ms_per_frame, result.recall, result.false_detections, result.corner_error,
+            result.parameters->adaptiveThreshWinSizeMin, result.parameters->adaptiveThreshWinSizeMax, result.parameters->adaptiveThreshWinSizeStep,
+            result.parameters->minMarkerPerimeterRate, result.parameters->maxMarkerPerimeterRate,
+            result.parameters->polygonalApproxAccuracyRate, result.parameters->cornerRefinementMethod);
+        if(chosen == nullptr && result.recall >= min_recall) chosen = &result;
+    }
 
-                outStream << endl;
+    if(chosen == nullptr) {
+        LOG(Error, Detection, "No detector parameters reach a recall of {}", min_recall);
+        return false;
+    }
+    LOG(Info, Detection, "Chosen parameters take {} ms per frame with a recall of {}", chosen->ms_per_frame, chosen->recall);
+    return saveDetectorParameters(parameters_file, chosen->parameters);
+}
 
-            } else {
-                // new data, remember time
-                timestamps.push(sys_time_data);
-            }
-        }
-        
-        // 5. close file
-        outStream.close();
-    } else {
-        // TODO: handle file not opening
+/// <sumary>
+/// Runs the SLAM on the detections recorded in a previous run, without decoding the video or detecting the markers.
+/// </sumary>
+/// <param name="reader">Opened detection log</param>
+/// <param name="segment">Segment, to which the camera poses and the marker map are written</param>
+/// <param name="ba_window_size">Number of frames in the sliding-window bundle adjustment, 0 for none</param>
+void replaySegment(DetectionLogReader& reader, VideoSegment& segment, const Mat& cameraMatrix, const Mat& distCoeff, float marker_length, int ba_window_size) {
+    RefinedPoses refined;
+    shared_ptr<MarkerMap> map = make_shared<MarkerMap>((int) segment.markers.size());
+    Tracker tracker(cameraMatrix, distCoeff, marker_length, map);
+    collectRefinedPoses(tracker, ba_window_size, refined);
+
+    int frame_num;
+    double timestamp;
+    bool blurred;
+    vector<int> ids;
+    vector<vector<Point2f>> corners;
+    while(reader.read(frame_num, timestamp, blurred, ids, corners)) {
+        segment.poses.push_back(tracker.processDetections(ids, corners, timestamp, frame_num, blurred));
     }
-    imuFile.close();
-    return 0;
+    LOG(Info, Main, "Replayed {} frames", segment.poses.size());
+
+    applyRefinedPoses(tracker, segment, refined);
+    map->snapshot(segment.markers, segment.marker_counter);
 }
 
+// only every frame_stride-th frame of the video is processed, counted from its first frame
+int frameStride(double fps, double output_rate) {
+    return output_rate > 0 ? max(1, (int) round(fps / output_rate)) : 1;
+}
+
+// frames between two read frames that are sought over instead of grabbed
+bool seeksOver(int skipped_frames) {
+    return skipped_frames > KEY_FRAME_INTERVAL;
+}
 
-int rewriteIMUfileToLibRSF(string imu_data_file, long* start_sec, long* start_nano) {
-    fstream imuFile;
-    imuFile.open(imu_data_file);
-    if(imuFile.fail()) {
-        cerr << "Could not read IMU data file: " + imu_data_file << endl;
-        return -4;
+/// <sumary>
+/// Moves the decoder to a frame. Skipped frames are grabbed without converting them to images. A seek restarts the
+/// decoding at the key frame before the target and decodes forward from there, so it only saves work when the gap
+/// is longer than the key frame interval, or when the decoder has to move back.
+/// </sumary>
+/// <param name="cap">Opened video</param>
+/// <param name="decoder_frame">Frame the decoder reads next, set to frame_num</param>
+/// <param name="frame_num">Frame to move to</param>
+/// <returns>False at the end of the video</returns>
+bool moveDecoder(VideoCapture& cap, int& decoder_frame, int frame_num) {
+    if(frame_num < decoder_frame || seeksOver(frame_num - decoder_frame)) {
+        if(!cap.set(CAP_PROP_POS_FRAMES, frame_num)) return false;
+    } else {
+        for(; decoder_frame < frame_num; decoder_frame++) {
+            if(!cap.grab()) return false;
+        }
     }
+    decoder_frame = frame_num;
+    return true;
+}
 
-    string line;
-    if(!getline(imuFile, line)) {
-        cerr << "Wrong IMU file format" << endl;
-        return -5;
+/// <sumary>
+/// Runs the tracker on the frames of the segment. The camera poses are appended to the segment
+/// and the segment's marker map is built in its own world frame, with the lowest ID marker first seen as the origin.
+/// </sumary>
+/// <param name="cap">Opened video, positioned at the first frame of the segment</param>
+/// <param name="segment">Segment to process</param>
+/// <param name="output_rate">Number of processed frames per second, the other frames are not decoded. 0 for every frame</param>
+/// <param name="ba_window_size">Number of frames in the sliding-window bundle adjustment, 0 for none</param>
+/// <param name="detector_parameters">Marker detection parameters</param>
+/// <param name="renderer">Renderer to which the frames are handed for display, nullptr for no preview</param>
+/// <param name="detection_log">Log, to which the detections are written, nullptr for none</param>
+/// <param name="frame_cache">Cache of the decoded frames, opened with the same frame stride, nullptr to decode every frame</param>
+/// <param name="stop_requested">Flag, that stops the processing when set</param>
+/// <param name="map">Marker map shared with other cameras, nullptr for a map of the segment only</param>
+void processSegment(VideoCapture& cap, VideoSegment& segment, const Mat& cameraMatrix, const Mat& distCoeff, float marker_length,
+                    double fps, long start_sec, long start_nano, bool save_frames, double output_rate, int ba_window_size,
+                    Ptr<aruco::DetectorParameters> detector_parameters, PreviewRenderer* renderer, DetectionLogWriter* detection_log,
+                    FrameCache* frame_cache, const atomic<bool>& stop_requested, shared_ptr<MarkerMap> map = nullptr) {
+    RefinedPoses refined;
+    if(!map) map = make_shared<MarkerMap>((int) segment.markers.size());
+
+    // cached frames may be smaller than the video, the camera model is scaled with them
+    Mat camera_matrix = cameraMatrix;
+    double scale = frame_cache != nullptr ? frame_cache->getSettings().scale : 1;
+    if(scale != 1) {
+        camera_matrix = cameraMatrix.clone();
+        camera_matrix.at<double>(0, 0) *= scale;
+        camera_matrix.at<double>(1, 1) *= scale;
+        camera_matrix.at<double>(0, 2) = (cameraMatrix.at<double>(0, 2) + 0.5) * scale - 0.5;
+        camera_matrix.at<double>(1, 2) = (cameraMatrix.at<double>(1, 2) + 0.5) * scale - 0.5;
     }
-    string nanosec = line.substr(line.size() - 9, 9);
-    string sec = line.substr(12, line.size() - 9 - 12);
 
-    *start_nano = stol(nanosec);
-    *start_sec = stol(sec);
+    Tracker tracker(camera_matrix, distCoeff, marker_length, map, detector_parameters);
+    tracker.use_fast_detector = USE_FAST_DETECTOR;
+    tracker.detection_interval = DETECTION_INTERVAL;
+    tracker.skip_blurred = BLUR_RATE > 0;
+    tracker.quality_filter.blur_rate = BLUR_RATE;
+    collectRefinedPoses(tracker, ba_window_size, refined);
 
-    // 1. create data.csv
-    ofstream outStream(REWRITTEN_IMU_DATA_FILE_PATH);
-    if(outStream) {
+    int frame_stride = frameStride(fps, output_rate);
+    // after a read the decoder is one frame past the last processed one
+    bool seek = seeksOver(frame_stride - 1);
+    if(frame_stride > 1) LOG(Info, Main, "Processing every {}. frame, skipped frames are {}", frame_stride, seek ? "sought over" : "grabbed");
 
-        // 3. copy data line by line into memory:
-        // use three queues, one for strings, two for floats
-        queue<string> timestamps;
-        queue<string> gyr_data;
-        queue<string> acc_data;
-        Vec3d current_velocity(0,0,0);
-        vector<double> tss(0);
-        int output_line_num = -1;
-        for(int i = 0; getline(imuFile, line); i++) {
-            // check first string
-            stringstream stream(line);
-            string s;
-            getline(stream, s, ' ');
+    // saved frames and logged corners are in the resolution of the video, as the calibration is
+    Size video_size((int) cap.get(CAP_PROP_FRAME_WIDTH), (int) cap.get(CAP_PROP_FRAME_HEIGHT));
+    Mat saved;
+    vector<vector<Point2f>> video_corners;
 
-            if(s.compare("VIDEO_STOP") == 0) break;  // end of data
+    // Work on the video frame-by-frame
+    Mat frame, decoded;
+    int decoder_frame = segment.first_frame;
+    uint64_t frame_start = metricsTime();
+    int first_frame = (segment.first_frame + frame_stride - 1) / frame_stride * frame_stride;
+    for(int frame_num = first_frame; (segment.end_frame < 0 || frame_num < segment.end_frame) && !stop_requested; frame_num += frame_stride) {
+        if(frame_cache != nullptr && frame_cache->read(frame_num, frame)) {
+            // decoded by an earlier run, the decoder stays where it is
+        } else {
+            if(!moveDecoder(cap, decoder_frame, frame_num)) break;
+            if(!cap.read(frame_cache != nullptr ? decoded : frame)) break;
+            decoder_frame++;
+            if(frame_cache != nullptr) frame_cache->store(frame_num, decoded, frame);
+        }
+        addStageTime(Stage::Decode, metricsTime() - frame_start);
 
-            string sys_time_data, event_time_data;
-            getline(stream, sys_time_data, ' ');
-            getline(stream, event_time_data, ' ');
+        long sec, nano;
+        double tmp = round(frame_num / fps * 1000000000) + start_nano;
+        nano = floor(tmp-floor(tmp/1000000000)*1000000000);
+        sec = start_sec + floor(tmp / 1000000000);
 
+        if(save_frames) {
+            // save this frame as an image
+            string img_name = format("%ld%09ld.png", sec, nano);
+            if(scale != 1) resize(frame, saved, video_size, 0, 0, INTER_LINEAR);
+            bool created = imwrite(SAVEFRAME_PATH + img_name, scale != 1 ? saved : frame);
+        }
 
-            if(s.compare("A") == 0) {
-                for(int j = 0; j < 3; j++) {
-                    getline(stream, s, ' ');
-                    acc_data.push(s);
-                }
-            } else if(s.compare("G") == 0) {
-                for(int j = 0; j < 3; j++) {
-                    getline(stream, s, ' ');
-                    gyr_data.push(s);
+        double timestamp = sec + nano / 1000000000.0;
+        segment.poses.push_back(tracker.processFrame(frame, timestamp, frame_num));
+        if(detection_log != nullptr && scale != 1) {
+            const vector<vector<Point2f>>& corners = tracker.getLastCorners();
+            video_corners.resize(corners.size());
+            for(size_t i = 0; i < corners.size(); i++) {
+                video_corners[i].resize(corners[i].size());
+                for(size_t k = 0; k < corners[i].size(); k++) {
+                    video_corners[i][k] = Point2f((float) ((corners[i][k].x + 0.5) / scale - 0.5), (float) ((corners[i][k].y + 0.5) / scale - 0.5));
                 }
-            } else if(s.compare("M") == 0) {
-                // Magnetometer: TODO
-                continue;
-            } else {
-                break;
             }
+            detection_log->write(frame_num, timestamp, segment.poses.back().blurred, tracker.getLastIds(), video_corners);
+        } else if(detection_log != nullptr) {
+            detection_log->write(frame_num, timestamp, segment.poses.back().blurred, tracker.getLastIds(), tracker.getLastCorners());
+        }
 
-            // 4. write data line by line into file
-            if(acc_data.size() > 0 && gyr_data.size() > 0) {
-                // data is ready, dont remember time
-                // outStream << timestamps.front();
-                string curr_timestamp = timestamps.front();
-                timestamps.pop();
-                nanosec = curr_timestamp.substr(curr_timestamp.size() - 9, 9);
-                sec = curr_timestamp.substr(0, curr_timestamp.size() - 9);
-
-                double ts = atof((sec + "." + nanosec).c_str());
-                // cout << ts << endl;
-                tss.push_back(ts);
-                output_line_num++;
-
-
-                // 1 - "odom3" [string]                        odom3
-                outStream << "odom3 ";
-                // 2 - time stamp [s]                          0.19999980926514
-                // outStream << sec << "." << nanosec << " ";
-                outStream << tss[output_line_num] << " ";
-
-
-                // get acceleration [m/s^2]
-                Vec3d acc(3);
-                for(int j = 0; j < 3; j++) {
-                    acc[j] = atof(acc_data.front().c_str());
-                    acc_data.pop();
-                }
-                if(output_line_num > 0) {
-                    double dt = tss[output_line_num] - tss[output_line_num-1];
-                    current_velocity += acc * dt / 2;
-                }
+        // Visualization code
+        if(renderer != nullptr && renderer->wantsFrame()) {
+            // frames of the cache point into its mapping, which may be closed before the renderer lets go of the frame
+            Mat shown = frame_cache != nullptr ? frame.clone() : frame;
+            renderer->submit(shown, tracker.getLastCorners(), tracker.getLastIds(), tracker.getLastRvecs(), tracker.getLastTvecs(), camera_matrix, distCoeff);
 
-                // 3 - velocity X-Axis [m/s]                   0
-                outStream << current_velocity[0] << " ";
-                // 4 - velocity Y-Axis [m/s]                   0
-                outStream << current_velocity[1] << " ";
-                // 5 - velocity Z-Axis [m/s]                   0
-                outStream << current_velocity[2] << " ";
+            // the renderer now shares the frame, the next one has to be read into a new buffer
+            frame.release();
+            // end visualization code
+        }
 
+        uint64_t frame_end = metricsTime();
+        addStageTime(Stage::Frame, frame_end - frame_start);
+        frame_start = frame_end;
+    }
 
-                Vec3d gyr(3);
-                for(int j = 0; j < 3; j++) {
-                    gyr[j] = atof(gyr_data.front().c_str());
-                    gyr_data.pop();
-                }
-                // 6 - turn rate X-Axis [rad/s]                0
-                outStream << gyr[0] << " ";
-                // 7 - turn rate Y-Axis [rad/s]                0
-                outStream << gyr[1] << " ";
-                // 8 - turn rate Z-Axis [rad/s]                -0.00034906585039887
-                outStream << gyr[2] << " ";
+    applyRefinedPoses(tracker, segment, refined);
+    map->snapshot(segment.markers, segment.marker_counter);
+}
 
+/// <sumary>
+/// Writes the camera poses of every frame, followed by the marker map, to the results file.
+/// </sumary>
+/// <param name="outputFile">Opened results file</param>
+/// <param name="segment">Processed segment, or all segments merged into one</param>
+void writeResults(ofstream& outputFile, const VideoSegment& segment) {
+    if(outputFile.fail()) return;
+    streampos start = outputFile.tellp();
+
+    int num_of_markers = (int) segment.markers.size();
+    const vector<MarkerInfo>& markers = segment.markers;
+    for(size_t i = 0; i < segment.poses.size(); i++) {
+        const FramePose& pose = segment.poses[i];
+        if(!pose.valid) {
+            outputFile << (pose.blurred ? "Blurred" : "Missing") << endl;
+            continue;
+        }
 
-                // 9  - covariance velocity X-Axis [m/s]^2     0.0025
-                outStream << 0.0025 << " ";
-                // 10 - covariance velocity Y-Axis [m/s]^2     0.0009
-                outStream << 0.0009 << " ";
-                // 11 - covariance velocity Z-Axis [m/s]^2     0.0009
-                outStream << 0.0009 << " ";
+        Quat<double> global_cam_orientation = Quat<double>::createFromRotMat(Mat(pose.orientation_matrix));
+        outputFile << "Frame," << pose.frame_num << ",";
+        outputFile << pose.num_detected << ",";
+        outputFile << pose.closest_marker_id << ",";
+        outputFile << pose.position.val[0] << ",";
+        outputFile << pose.position.val[1] << ",";
+        outputFile << pose.position.val[2] << ",";
+        outputFile << global_cam_orientation.x << ",";
+        outputFile << global_cam_orientation.y << ",";
+        outputFile << global_cam_orientation.z << ",";
+        outputFile << global_cam_orientation.w;
+
+        for(size_t j = 0; j < pose.visible_ids.size(); j++) {
+            outputFile << "," << pose.visible_ids[j];
+        }
+        outputFile << endl;
+    }
 
+    outputFile << "MaxNumMarkers," << num_of_markers << endl;
 
-                // 12 - covariance turn rate X-Axis [rad/s]^2  4e-06
-                outStream << 4e-06 << " ";
-                // 13 - covariance turn rate Y-Axis [rad/s]^2  4e-06
-                outStream << 4e-06 << " ";
-                // 14 - covariance turn rate Z-Axis [rad/s]^2  4e-06
-                outStream << 4e-06 << " ";
+    for(int i = 0; i < num_of_markers; i++) {
+        /*
+        outputFile << "ID: " << markers[i].marker_id << endl;
+        outputFile << "T: " << markers[i].world_position << endl;
+        outputFile << "R: " << markers[i].world_orientation << endl;
+        */
+        outputFile << markers[i].marker_id;
+        outputFile << "," << markers[i].world_position.val[0];
+        outputFile << "," << markers[i].world_position.val[1];
+        outputFile << "," << markers[i].world_position.val[2];
+        outputFile << "," << markers[i].world_orientation.x;
+        outputFile << "," << markers[i].world_orientation.y;
+        outputFile << "," << markers[i].world_orientation.z;
+        outputFile << "," << markers[i].world_orientation.w;
+        outputFile << endl;
+    }
+    addMetric(Metric::OutputBytes, (uint64_t) (outputFile.tellp() - start));
+}
 
+/// <sumary>
+/// Shows the metrics of a running VideoSLAM process every second, until the process finishes.
+/// </sumary>
+/// <param name="run">Process ID of the run, or the name of its metrics segment</param>
+/// <param name="prometheus_file">File, to which the metrics are written in the Prometheus text format instead, empty to print them</param>
+int readMetrics(string run, string prometheus_file) {
+    string name = run;
+    if(!run.empty() && all_of(run.begin(), run.end(), ::isdigit)) name = metricsSegmentName(stoull(run));
+
+    MetricsReader reader;
+    while(!reader.open(name)) {
+        LOG(Info, Main, "Waiting for a VideoSLAM process to export its metrics as {}", name);
+        flushLog();
+        this_thread::sleep_for(chrono::seconds(1));
+    }
 
-                outStream << endl;
+    while(true) {
+        bool finished = reader.isFinished();
+        if(prometheus_file.empty()) reader.print(cout);
+        else if(!reader.writePrometheus(prometheus_file)) LOG(Warning, Main, "Could not write the metrics to {}", prometheus_file);
+        if(finished) return 0;
+        this_thread::sleep_for(chrono::seconds(1));
+    }
+}
 
-            } else {
-                // new data, remember time
-                timestamps.push(sys_time_data);
-            }
-        }
+/// <sumary>
+/// Reads the frame rate of the video, that a run copies next to its results.
+/// </sumary>
+/// <param name="results_file">Results file of the run</param>
+/// <returns>Frames per second, 0 if the video is missing</returns>
+double runFrameRate(string results_file) {
+    experimental::filesystem::path video = experimental::filesystem::path(results_file).parent_path() / experimental::filesystem::path(OUTPUT_VIDEO_PATH).filename();
+    VideoCapture cap(video.string());
+    double fps = cap.isOpened() ? cap.get(CAP_PROP_FPS) : 0;
+    return fps > 0 ? fps : 0;
+}
+
+/// <sumary>
+/// Evaluates the results of many runs against a reference trajectory and writes the errors into a summary table.
+/// The frame rate of each run is taken from the video in its directory, runs without one use the given frame rate.
+/// </sumary>
+/// <param name="reference_file">Reference trajectory, a results file or a TUM trajectory</param>
+/// <param name="summary_file">CSV file, to which one line per run is written</param>
+/// <param name="runs">Results files, or directories whose CSV files are all evaluated, except the reference and the summary</param>
+/// <param name="fps">Frame rate of the runs without a video, 0 if none was given</param>
+int evaluateRuns(string reference_file, string summary_file, const vector<string>& runs, double fps) {
+    auto frameRate = [&](string results_file) {
+        double run_fps = runFrameRate(results_file);
+        if(run_fps > 0) return run_fps;
+        if(fps > 0) return fps;
+        LOG(Warning, Main, "No video next to {} and no --fps given, assuming 30 fps", results_file);
+        return 30.0;
+    };
+
+    double reference_fps = frameRate(reference_file);
+    Trajectory reference;
+    if(!readReferenceTrajectory(reference_file, reference_fps, reference) || reference.poses.empty()) {
+        LOG(Error, Main, "Could not read the reference trajectory {}", reference_file);
+        return -8;
+    }
 
-        // add "GPS" data
-        // TODO: include actual data
-        for(int i = 0; i < tss.size(); i++) {
-
-            // ## pseudoranges ##
-            // 1 - "pseudorange3"[string]                         pseudorange3
-            outStream << "pseudorange3" << " ";
-            // 2 - time stamp[s]                                  0
-            outStream << to_string(tss[i]) << " ";
-            // 3 - pseudorange mean[m]                            0
-            outStream << 0 << " ";
-            // 4 - pseudorange covariance[m] ^ 2                  100
-            outStream << 100 << " ";
-            // 5 - satellite position ECEF - X[m]                 0
-            outStream << 0 << " ";
-            // 6 - satellite position ECEF - Y[m]                 0
-            outStream << 0 << " ";
-            // 7 - satellite position ECEF - Z[m]                 0
-            outStream << 0 << " ";
-            // 8 - satellite ID                                   0
-            outStream << 0 << " ";
-            // 9 - satellite elevation angle[deg]                 0
-            outStream << 0 << " ";
-            // 10 - carrier - to - noise density ratio[dBHz]      0
-            outStream << 0 << endl;
+    vector<string> result_files;
+    for(size_t i = 0; i < runs.size(); i++) {
+        if(!experimental::filesystem::is_directory(runs[i])) {
+            result_files.push_back(runs[i]);
+            continue;
         }
+        for(const auto& entry : experimental::filesystem::directory_iterator(runs[i])) {
+            if(entry.path().extension() != ".csv") continue;
+
+            // the reference and the summary of an earlier evaluation may lie among the results
+            error_code error;
+            if(experimental::filesystem::equivalent(entry.path(), reference_file, error)) continue;
+            if(experimental::filesystem::equivalent(entry.path(), summary_file, error)) continue;
+            result_files.push_back(entry.path().string());
+        }
+    }
+    sort(result_files.begin(), result_files.end());
 
-        // 5. close file
-        outStream.close();
-    } else {
-        // TODO: handle file not opening
+    vector<double> frame_rates(result_files.size());
+    for(size_t i = 0; i < result_files.size(); i++) frame_rates[i] = frameRate(result_files[i]);
+
+    uint64_t start = metricsTime();
+    TrajectoryEvaluator evaluator(reference, reference_fps);
+    vector<TrajectoryEvaluation> evaluations = evaluator.evaluateRuns(result_files, frame_rates);
+    LOG(Info, Main, "Evaluated {} runs against {} reference poses in {} ms", evaluations.size(), reference.poses.size(), (metricsTime() - start) / 1000000);
+
+    if(!TrajectoryEvaluator::writeSummary(summary_file, evaluations)) {
+        LOG(Error, Main, "Could not write the summary {}", summary_file);
+        return -8;
     }
-    imuFile.close();
     return 0;
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    // "VideoSLAM metrics run [file]" shows the metrics of a running process, or exports them to a Prometheus text file
+    if(argc > 1 && string(argv[1]) == "metrics") {
+        if(argc < 3) {
+            LOG(Error, Main, "Usage: VideoSLAM metrics <process ID or segment name> [metrics.prom]");
+            flushLog();
+            return -10;
+        }
+        return readMetrics(argv[2], argc > 3 ? argv[3] : "");
+    }
+    // "VideoSLAM evaluate [--fps rate] reference summary runs..." compares the results of earlier runs with a reference trajectory
+    if(argc > 1 && string(argv[1]) == "evaluate") {
+        int first = 2;
+        double fps = 0;
+        if(argc > 3 && string(argv[2]) == "--fps") {
+            fps = atof(argv[3]);
+            first = 4;
+        }
+        if(argc < first + 3) {
+            LOG(Error, Main, "Usage: VideoSLAM evaluate [--fps <rate>] <reference> <summary.csv> <results or directories>...");
+            flushLog();
+            return -8;
+        }
+        int evaluated = evaluateRuns(argv[first], argv[first + 1], vector<string>(argv + first + 2, argv + argc), fps);
+        flushLog();
+        return evaluated;
+    }
+    // "VideoSLAM bench [results.csv] [filter]" times the hot functions on generated inputs
+    if(argc > 1 && string(argv[1]) == "bench") {
+        int benchmarked = runBenchmarks(argc > 2 ? argv[2] : BENCHMARK_RESULTS_PATH, argc > 3 ? argv[3] : "");
+        flushLog();
+        return benchmarked;
+    }
+
     /*
     vector<MarkerInfo> m_marker(2);
 
@@ -485,16 +618,38 @@ int main() {
     // Prepare fixed information
     int num_of_markers = 12;
     bool visualize = true;
+    double preview_refresh_rate = 30;       // maximal number of frames per second the preview displays
     float marker_length = 0.050f; // meters
-    vector<MarkerInfo> markers(num_of_markers);
-    vector<vector<Point2f>> corners, rejects;
-    Ptr<aruco::DetectorParameters> parameters = aruco::DetectorParameters::create();
+    int num_segments = 1;                   // number of parts the video is split into and processed concurrently
+    int ba_window_size = 0;                 // number of last frames refined by bundle adjustment, 0 to disable it
+    double output_rate = 0;                 // poses per second, frames in between are not decoded. 0 for every frame
+    bool cache_frames = false;              // keep the decoded frames in FRAME_CACHE_PATH, later runs over the same video do not decode them
+    FrameCacheSettings cache_settings;      // grayscale and size of the cached frames
+    double cache_size_gb = 20;              // the least recently used videos are evicted from the frame cache above this size
 
     bool save_frames = true;                // should the video break down the video into frames
-    string save_frames_path = "DeconVid/";  // path to the directory to whic the frames will be saved
-
-    bool first_marker_detected = false;
-    int lowest_marker_id = -1;
+    bool record_detections = false;         // write the detections of every frame to the detection log, needed to replay them
+    bool replay_detections = false;         // run the SLAM on the detection log of a previous run instead of the video
+    bool tune_detector = false;             // search the detector parameters for the video instead of running the SLAM
+    int tuning_frames = 40;                 // number of frames the detector parameters are measured on
+    int tuning_candidates = 64;             // number of detector parameter sets tried
+    double tuning_min_recall = 0.98;        // lowest fraction of the reference detections the tuned parameters have to find
+    LogLevel log_level = LogLevel::Info;    // Debug and Trace also log every frame
+    string metrics_name = metricsSegmentName();     // shared memory segment of the live metrics, unique to this process
+
+    // cameras of the rig, all of them are mapped into one world frame. The IMU data belongs to the first one.
+    vector<CameraInput> cameras = {
+        {VIDEO_PATH, "Calibration/calibration", RESULTS_FILE_PATH, DETECTION_LOG_PATH},
+        // {"InputVideos/SF_Video_5_2.mp4", "Calibration/calibration_2", "Results/Ground_Truth_Data_2.csv", "Results/Detections_2.bin"},
+    };
+
+    setLogLevel(log_level);
+
+    // live counters, that other processes can read while the video is processed
+    if(openMetrics(metrics_name)) {
+        atexit(closeMetrics);
+        LOG(Info, Main, "Metrics are exported as {}, show them with: VideoSLAM metrics {}", metrics_name, metrics_name);
+    }
 
     // Generate Marker Images
     generateArucoMarkers(num_of_markers);
@@ -502,54 +657,69 @@ int main() {
     // Generate output folder and file
     _mkdir("Results");
     ofstream outputFile;
-    outputFile.open(RESULTS_FILE_PATH);
+    outputFile.open(cameras[0].results_file);
     // if(!outputFile.fail()) outputFile << "MaxNumMarkers: " << num_of_markers << endl;
     // else cout << "Cannot create output file" << endl;
 
     // Check for camera calibration
-    string calibration_data_file_name = "Calibration/calibration";
-    ifstream inputFile;
-    inputFile.open(calibration_data_file_name);
-    if(inputFile.fail()) {
-        // no calibration file has been found
-        cerr << "Could not open calibration file" << endl;
-
-        // calibrate
-        cout << "Initiating calibration:" << endl;
-        CamCalib cameraCalibration;
-        cameraCalibration.myCalibrateCamera(calibration_data_file_name, false);
-
-        // try reading again
-        inputFile.open(calibration_data_file_name);
-        if(inputFile.fail()) {
-            cerr << "Could not open calibration file after calibration" << endl;
-            cerr << "Closing application" << endl;
+    vector<CalibrationData> calibrations(cameras.size());
+    for(size_t c = 0; c < cameras.size(); c++) {
+        if(!loadCalibration(cameras[c].calibration_file, c == 0, calibrations[c])) {
+            LOG(Error, Main, "Closing application");
             return 3;
         }
     }
+    const CalibrationData& calibration = calibrations[0];
 
-    // read the data
-    Mat cameraMatrix = Mat::eye(3, 3, CV_64F);
-    Mat distCoeff = Mat::zeros(5, 1, CV_64F);
-    readCalibrationData(inputFile, cameraMatrix, distCoeff);
-    inputFile.close();
+    Mat cameraMatrix = calibration.cameraMatrix;
+    Mat distCoeff = calibration.distortionCoefficients;
     
-    cout << cameraMatrix << endl;
-    cout << distCoeff << endl;
+    LOG(Info, Calibration, "Camera matrix: {}", cameraMatrix);
+    ostringstream coefficients;
+    coefficients << distCoeff.t();
+    LOG(Info, Calibration, "Distortion coefficients: {}", coefficients.str());
+    LOG(Info, Calibration, "Calibration RMS: {}", calibration.rms);
+
+    Ptr<aruco::DetectorParameters> detector_parameters = aruco::DetectorParameters::create();
+    if(loadDetectorParameters(DETECTOR_PARAMETERS_PATH, detector_parameters)) {
+        LOG(Info, Detection, "Detector parameters loaded from {}", DETECTOR_PARAMETERS_PATH);
+    }
+
+    if(replay_detections) {
+        // the SLAM runs on the detections of a previous run, the video is not decoded
+        DetectionLogReader reader;
+        if(!reader.open(cameras[0].detection_log_file)) {
+            LOG(Error, Main, "Cannot replay the detections");
+            return -6;
+        }
+
+        VideoSegment segment(0, -1, num_of_markers);
+        replaySegment(reader, segment, cameraMatrix, distCoeff, marker_length, ba_window_size);
+        writeResults(outputFile, segment);
+        outputFile.close();
+        return 0;
+    }
 
     // Find and open the video
     // VideoCapture cap("InputVideos/Input_Video_1.mp4");
     // VideoCapture cap("InputVideos/real_set_1/D1_WM_A_V2.mp4");
     // VideoCapture cap("InputVideos/real_set_2/SF_Video_9.mp4");
-    VideoCapture cap(VIDEO_PATH);
+    VideoCapture cap(cameras[0].video_path);
     // VideoCapture cap("InputVideos/set_5_rot_3/SF_Video_3.mp4");
     // VideoCapture cap(0);
     if(!cap.isOpened()) {
-        cout << "Cannot open the input video file" << endl;
+        LOG(Error, Main, "Cannot open the input video file");
+        flushLog();
         cin.get();
         return -1;
     }
 
+    if(tune_detector) {
+        bool tuned = tuneDetector(cap, tuning_frames, tuning_candidates, tuning_min_recall, DETECTOR_PARAMETERS_PATH);
+        flushLog();
+        return tuned ? 0 : -7;
+    }
+
     if(save_frames) {
         // check if there is a save directory
         int is_dir_made = _mkdir(SAVEFRAME_PATH);
@@ -561,7 +731,7 @@ int main() {
             }
 
             if(is_dir_made != 0){
-                cerr << "Cannot create saveframe directory" << endl;
+                LOG(Error, Main, "Cannot create saveframe directory");
                 return -2;
             }
         }
@@ -571,335 +741,133 @@ int main() {
     
     // rewrite used video to indicate which video was used
     remove(OUTPUT_VIDEO_PATH);
-    if(experimental::filesystem::copy_file(VIDEO_PATH, OUTPUT_VIDEO_PATH)) {
-        cout << "Input video saved" << endl;
+    if(experimental::filesystem::copy_file(cameras[0].video_path, OUTPUT_VIDEO_PATH)) {
+        LOG(Info, Main, "Input video saved");
     }
 
 
     double fps = cap.get(CAP_PROP_FPS);
-    std::cout << "Frames per seconds : " << fps << endl;
+    LOG(Info, Main, "Frames per seconds : {}", fps);
 
 
     long start_nano, start_sec;
-    // int rewrite_res = rewriteIMUfileToLibRSF(SENSOR_DATA_FILE_PATH, &start_sec, &start_nano);
-    int rewrite_res = rewriteIMUfile(SENSOR_DATA_FILE_PATH, &start_sec, &start_nano);
+    // int rewrite_res = rewriteIMUfileToLibRSF(SENSOR_DATA_FILE_PATH, fps, &start_sec, &start_nano, REWRITTEN_IMU_DATA_FILE_PATH);
+    int rewrite_res = rewriteIMUfile(SENSOR_DATA_FILE_PATH, &start_sec, &start_nano, REWRITTEN_IMU_DATA_FILE_PATH);
     if(rewrite_res != 0) return rewrite_res;
 
-    // Visualization code
-    String window_name = "Video Preview";
+    // Visualization code, the first segment is displayed
+    atomic<bool> stop_requested(false);
+    unique_ptr<PreviewRenderer> renderer;
     if(visualize) {
-        namedWindow(window_name, WINDOW_NORMAL);
+        renderer.reset(new PreviewRenderer("Video Preview", preview_refresh_rate, stop_requested));
     }
 
-    // Work on the video frame-by-frame
-    Mat frame;
-    int marker_counter = 0;
-    for(int frame_num = 0; cap.read(frame); frame_num++) {
-        if(save_frames) {
-            long sec, nano;
-            double tmp = round(frame_num / fps * 1000000000) + start_nano;
-            nano = floor(tmp-floor(tmp/1000000000)*1000000000);
-            // cout << tmp << endl;
-            // cout << nano << endl;
-            // cout << floor(tmp/1000000000) << endl;
-            sec = start_sec + floor(tmp / 1000000000);
-            // cout << sec << endl;
-
-            // save this frame as an image
-            string img_name = format("%ld%09ld.png", sec, nano);
-            // cout << img_name << endl;
-            bool created = imwrite(save_frames_path + img_name, frame);
-            // cin.get();
-            // return 1;
-        }
-
-        // set frame specific variables
-        vector<MarkerInfo> temp_markers;
-        int marker_counter_previous = marker_counter;
-        for(int i = 0; i < num_of_markers; i++)
-            markers[i].visible = false;
-
-        // detect markers in this frame
-        vector<int> detected_IDs;
-        aruco::detectMarkers(frame, dictionary, corners, detected_IDs, parameters, rejects);
-
-        // marker pose estimation
-        vector<Vec3d> rvecs, tvecs;
-        aruco::estimatePoseSingleMarkers(corners, marker_length, cameraMatrix, distCoeff, rvecs, tvecs);
-
-        // Visualization code
-        if(visualize) {
-            aruco::drawDetectedMarkers(frame, corners, detected_IDs);
-            // cout << marker_IDs.size() << endl;
-            for(int i = 0; i < detected_IDs.size(); i++) {
-                cout << detected_IDs[i] << endl;
-
-                aruco::drawAxis(frame, cameraMatrix, distCoeff, rvecs[i], tvecs[i], 0.1f);
-            }
-            imshow(window_name, frame);
-            cout << endl;
-            // end visualization code
-
-            if(waitKey(1) == 27) {
-                cout << "ESC pressed" << endl;
-                break;
-            }
+    if(cameras.size() > 1) {
+        // every camera gets its own decoder and thread, all of them share the marker map
+        LOG(Info, Main, "Processing {} cameras", cameras.size());
+        cap.release();
+        shared_ptr<MarkerMap> map = make_shared<MarkerMap>(num_of_markers);
+        vector<VideoSegment> camera_results(cameras.size(), VideoSegment(0, -1, num_of_markers));
+        vector<thread> workers;
+        for(size_t c = 0; c < cameras.size(); c++) {
+            workers.push_back(thread([&, c]() {
+                VideoCapture camera_cap(cameras[c].video_path);
+                if(!camera_cap.isOpened()) {
+                    LOG(Error, Main, "Cannot open the input video file {}", cameras[c].video_path);
+                    return;
+                }
+                DetectionLogWriter detection_log;
+                if(record_detections) detection_log.open(cameras[c].detection_log_file);
+                FrameCache frame_cache(FRAME_CACHE_PATH, (uint64_t) (cache_size_gb * 1e9));
+                FrameCacheSettings camera_cache_settings = cache_settings;
+                camera_cache_settings.stride = frameStride(camera_cap.get(CAP_PROP_FPS), output_rate);
+                if(cache_frames) frame_cache.open(cameras[c].video_path, camera_cap, camera_cache_settings);
+                processSegment(camera_cap, camera_results[c], calibrations[c].cameraMatrix, calibrations[c].distortionCoefficients, marker_length,
+                               camera_cap.get(CAP_PROP_FPS), start_sec, start_nano, save_frames && c == 0, output_rate, ba_window_size,
+                               detector_parameters, c == 0 ? renderer.get() : nullptr, record_detections ? &detection_log : nullptr,
+                               frame_cache.isOpen() ? &frame_cache : nullptr, stop_requested, map);
+            }));
         }
-
-
-        ///////////////////////////////////////////////
-        // SLAM
-        ///////////////////////////////////////////////
-        size_t num_detected = detected_IDs.size();
-        if(num_detected <= 0) {
-            cout << "No Markers detected" << endl;
-
-            if(!outputFile.fail()) {
-                outputFile << "Missing" << endl;
-            }
-
-            continue;
+        for(size_t c = 0; c < cameras.size(); c++) {
+            workers[c].join();
         }
-        // markers are detected
 
-
-        // handle first detected marker
-        if(!first_marker_detected) {
-            first_marker_detected = true;
-
-            // detect the marker with lowest ID
-            int lowest_i = 0;
-            lowest_marker_id = detected_IDs[lowest_i];
-            for(int i = 1; i < num_detected; i++) {
-                if(detected_IDs[i] < lowest_marker_id) {
-                    lowest_marker_id = detected_IDs[i];
-                    lowest_i = i;
-                }
-            }
-
-            // set it to world's origin
-            markers[0].marker_id = lowest_marker_id;
-
-            markers[0].world_position = Vec3d(0, 0, 0);
-            // markers[0].world_orientation = Quat<double>(1, 0, 0, 0);
-            markers[0].world_orientation_matrix = Mat::eye(3, 3, CV_64F);
-            markers[0].world_orientation = Quat<double>::createFromRotMat(markers[0].world_orientation_matrix);
-
-            // relative position equals Global position
-            markers[0].to_prev_position = Vec3d(0, 0, 0);
-            // markers[0].to_prev_orientation = Quat<double>(1, 0, 0, 0);
-            markers[0].to_prev_orientation_matrix = Mat::eye(3, 3, CV_64F);
-            markers[0].to_prev_orientation = Quat<double>::createFromRotMat(markers[0].to_prev_orientation_matrix);
-
-            // camera position is trivial
-            getCameraPoseBasedOnMarker(markers[0], rvecs[lowest_i], tvecs[lowest_i]);
-            // markerPoseInverse(markers[0]);
-
-            // increase count
-            marker_counter++;
-            
-            // visibility
-            markers[0].visible = true;
-
-            // previous marker
-            markers[0].previous_marker_index = WORLD;
-
-            cout << "Lowest Id marker: " << lowest_marker_id << endl;
+        // markers mapped by the other cameras after a camera has finished
+        for(size_t c = 0; c < cameras.size(); c++) {
+            map->snapshot(camera_results[c].markers, camera_results[c].marker_counter);
         }
 
-        // change visibility flag of detected old markers
-        for(int j = 0; j < marker_counter; j++) {
-            for(int k = 0; k < num_detected; k++) {
-                if(markers[j].marker_id == detected_IDs[k])
-                    markers[j].visible = true;
-            }
+        writeResults(outputFile, camera_results[0]);
+        outputFile.close();
+        for(size_t c = 1; c < cameras.size(); c++) {
+            ofstream cameraFile(cameras[c].results_file);
+            writeResults(cameraFile, camera_results[c]);
         }
 
-        // for every marker do:
-        for(int i = 0; i < num_detected; i++) {
-            int index;
-            int current_id = detected_IDs[i];
-
-            // NOTE: could draw here
-
-            // check wether marker exists or not
-            bool existing = false;
-            for(int temp_counter = 0; !existing && temp_counter < marker_counter; temp_counter++) {
-                if(markers[temp_counter].marker_id == current_id) {
-                    index = temp_counter;
-                    existing = true;
-                    cout << "Found existing marker with ID: " << current_id << endl;
-                }
-            }
-
-            if(!existing) {
-                // new marker detected
-                index = marker_counter;
-                markers[index].marker_id = current_id;
-                markers[index].visible = true;
-                existing = true;
-                cout << "Detected new marker with ID: " << current_id << endl;
-
-                getCameraPoseBasedOnMarker(markers[index], rvecs[i], tvecs[i]);
-                // markerPoseInverse(markers[index]);
-
-                /*
-                // NOTE: might be unneceserry here
-                // test if position can be calculated based on old known marker
-                bool any_known_marker_visible = false;
-                int last_marker_id;
-                for(int k = 0; k < index && !any_known_marker_visible; k++) {
-                    if(markers[k].visible == true && markers[k].previous_marker_id != -1) {
-                        any_known_marker_visible = true;
-                        markers[index].previous_marker_id = k;
-                        last_marker_id = k;
-                    }
-                }
-
-                if(any_known_marker_visible) {
-                    // compute transform between two markers and apply world transform
-                    computeTransforms(markers[index], markers[last_marker_id]);
-
-                    marker_counter++;
-                    markerPoseInverse(markers[index]);
-                }
-                */
-            } else {
-                // old marker detected
-                getCameraPoseBasedOnMarker(markers[index], rvecs[i], tvecs[i]);
-                // markerPoseInverse(markers[index]);
-            }
+        return 0;
+    }
 
-            // TODO: check if this is even needed, since the world transform is calculated when previous transform is calculated
-            /*
-            // compute global position of a new marker
-            if(marker_counter_previous < marker_counter) {  // NOTE: this might be problematic or cause unnecesarry computations
-                // TODO: calculate geometry to world transform
-                // TODO: save the world transform to MarkerInfo
-            }
-            */
-
-            // check if the marker has a detected previous marker
-            if(markers[index].previous_marker_index == -1) {
-                // test if position can be calculated based on old known marker
-                bool any_known_marker_visible = false;
-                int last_marker_id;
-                for(int k = 0; k < index && !any_known_marker_visible; k++) {
-                    if(markers[k].visible == true && markers[k].previous_marker_index != -1) {
-                        any_known_marker_visible = true;
-                        markers[index].previous_marker_index = k;
-                        last_marker_id = k;
-                    }
-                }
+    // Work on the video
+    int frame_count = (int) cap.get(CAP_PROP_FRAME_COUNT);
+    if(num_segments < 1 || frame_count < num_segments) num_segments = 1;
 
-                if(any_known_marker_visible) {
-                    // compute transform between two markers and apply world transform
-                    computeTransforms(markers[index], markers[last_marker_id]);
+    vector<VideoSegment> segments;
+    for(int i = 0; i < num_segments; i++) {
+        int first_frame = (int) ((long long) frame_count * i / num_segments);
+        int end_frame = i + 1 < num_segments ? (int) ((long long) frame_count * (i + 1) / num_segments) : -1;
+        segments.push_back(VideoSegment(first_frame, end_frame, num_of_markers));
+    }
 
-                    marker_counter++;
-                    // markerPoseInverse(markers[index]);
+    // shared by the segments, each of them stores its own frames
+    FrameCache frame_cache(FRAME_CACHE_PATH, (uint64_t) (cache_size_gb * 1e9));
+    cache_settings.stride = frameStride(fps, output_rate);
+    if(cache_frames) frame_cache.open(cameras[0].video_path, cap, cache_settings);
+    FrameCache* segment_cache = frame_cache.isOpen() ? &frame_cache : nullptr;
+
+    if(num_segments == 1) {
+        DetectionLogWriter detection_log;
+        if(record_detections) detection_log.open(cameras[0].detection_log_file);
+        processSegment(cap, segments[0], cameraMatrix, distCoeff, marker_length, fps, start_sec, start_nano, save_frames, output_rate, ba_window_size,
+                       detector_parameters, renderer.get(), record_detections ? &detection_log : nullptr, segment_cache, stop_requested);
+    } else {
+        // every segment gets its own decoder and thread
+        LOG(Info, Main, "Processing {} segments of {} frames", num_segments, frame_count);
+        if(record_detections) LOG(Warning, Main, "Detections are only recorded when the video is processed as a single segment");
+        cap.release();
+        vector<thread> workers;
+        for(int i = 0; i < num_segments; i++) {
+            workers.push_back(thread([&, i]() {
+                VideoCapture segment_cap(cameras[0].video_path);
+                if(!segment_cap.isOpened()) {
+                    LOG(Error, Main, "Cannot open the input video file for segment {}", i);
+                    return;
                 }
-            }
+                segment_cap.set(CAP_PROP_POS_FRAMES, segments[i].first_frame);
+                processSegment(segment_cap, segments[i], cameraMatrix, distCoeff, marker_length, fps, start_sec, start_nano, save_frames, output_rate, ba_window_size,
+                               detector_parameters, i == 0 ? renderer.get() : nullptr, nullptr, segment_cache, stop_requested);
+            }));
         }
-
-        // compute which of the visible markers is the closest to the camera
-        double minimal_distance = INIT_MIN_SIZE_VALUE;
-        int closest_index = -1;
-        for(int k = 0; k < num_of_markers; k++) {
-            
-            // check if marker is visible
-            if(markers[k].visible) {
-                double a = markers[k].current_camera_pose_position.val[0];
-                double b = markers[k].current_camera_pose_position.val[1];
-                double c = markers[k].current_camera_pose_position.val[2];
-                double size = sqrt(a*a + b * b + c * c);
-                
-                if(size < minimal_distance) {
-                    minimal_distance = size;
-                    closest_index = k;
-                }
-            }
+        for(int i = 0; i < num_segments; i++) {
+            workers[i].join();
         }
 
-        // check if closest marker has world position
-        if(markers[closest_index].previous_marker_index != -1) {
-            // compute global camera pose
-            // Vec3d global_cam_position = markers[closest_index].world_position + markers[closest_index].current_camera_pose_position;
-            // Quat<double> global_cam_orientation = markers[closest_index].world_orientation * markers[closest_index].current_camera_pose_orientation;
-            // Vec3d global_cam_position = (Matx33d) (Mat) markers[closest_index].world_orientation_matrix * (markers[closest_index].current_camera_pose_position - ((Matx33d) (Mat) markers[closest_index].world_orientation_matrix.inv()) * (-markers[closest_index].world_position));
-            // cout << endl;
-            Vec3d global_cam_position = markers[closest_index].world_position + (Matx33d) (Mat) markers[closest_index].world_orientation_matrix.inv() * markers[closest_index].current_camera_pose_position;
-            // cout << markers[closest_index].world_orientation_matrix << endl;
-            // cout << markers[closest_index].current_camera_pose_orientation_matrix << endl;
-            // Mat global_cam_orientation_matrix = markers[closest_index].world_orientation_matrix.t() * markers[closest_index].current_camera_pose_orientation_matrix;
-            Mat global_cam_orientation_matrix = markers[closest_index].current_camera_pose_orientation_matrix * markers[closest_index].world_orientation_matrix;
-            Quat<double> global_cam_orientation = Quat<double>::createFromRotMat(global_cam_orientation_matrix);
-
-            cout << global_cam_position << endl;
-            cout << global_cam_orientation.toRotMat3x3() << endl;
-
-            // output
-            // cout << "Frame: " << frame_num << endl;
-            // cout << "Camera pose based on marker: " << markers[closest_index].marker_id << endl;
-            // cout << "t: " << global_cam_position << endl;
-            // cout << "r: " << global_cam_orientation << endl;
-            // cout << "d: " << minimal_distance << endl;
-
-            if(!outputFile.fail()) {
-                /*
-                outputFile << "Frame: " << frame_num << endl;
-                outputFile << "NumMarkers: " << num_detected << endl;
-                outputFile << "ClosestMarker: " << markers[closest_index].marker_id << endl;
-                outputFile << "T: " << global_cam_position << endl;
-                outputFile << "R: " << global_cam_orientation << endl;
-                */
-                outputFile << "Frame," << frame_num << ",";
-                outputFile << num_detected << ",";
-                outputFile << markers[closest_index].marker_id << ",";
-                outputFile << global_cam_position.val[0] << ",";
-                outputFile << global_cam_position.val[1] << ",";
-                outputFile << global_cam_position.val[2] << ",";
-                outputFile << global_cam_orientation.x << ",";
-                outputFile << global_cam_orientation.y << ",";
-                outputFile << global_cam_orientation.z << ",";
-                outputFile << global_cam_orientation.w;
-
-                for(int i = 0; i < num_of_markers; i++) {
-                    if(markers[i].visible) {
-                        outputFile << "," << markers[i].marker_id;
-                    }
+        // express every segment in the world frame of the first one
+        for(int i = 1; i < num_segments; i++) {
+            if(!segments[i].alignTo(segments[0])) {
+                LOG(Warning, Main, "Segment starting at frame {} shares no markers with the previous segments", segments[i].first_frame);
+                for(size_t j = 0; j < segments[i].poses.size(); j++) {
+                    segments[i].poses[j].valid = false;
                 }
-                outputFile << endl;
-            }
-        } else {
-            cout << "Cannot get accurate cam position" << endl;
-            
-            if(!outputFile.fail()) {
-                outputFile << "Missing" << endl;
+
+                // its markers are in an unrelated world frame, only the frames are kept
+                segments[0].poses.insert(segments[0].poses.end(), segments[i].poses.begin(), segments[i].poses.end());
+                continue;
             }
+            segments[i].mergeInto(segments[0]);
         }
     }
 
-    if(!outputFile.fail()) {
-        outputFile << "MaxNumMarkers," << num_of_markers << endl;
-
-        for(int i = 0; i < num_of_markers; i++) {
-            /*
-            outputFile << "ID: " << markers[i].marker_id << endl;
-            outputFile << "T: " << markers[i].world_position << endl;
-            outputFile << "R: " << markers[i].world_orientation << endl;
-            */
-            outputFile << markers[i].marker_id;
-            outputFile << "," << markers[i].world_position.val[0];
-            outputFile << "," << markers[i].world_position.val[1];
-            outputFile << "," << markers[i].world_position.val[2];
-            outputFile << "," << markers[i].world_orientation.x;
-            outputFile << "," << markers[i].world_orientation.y;
-            outputFile << "," << markers[i].world_orientation.z;
-            outputFile << "," << markers[i].world_orientation.w;
-            outputFile << endl;
-        }
-    }
+    writeResults(outputFile, segments[0]);
 
     outputFile.close();
 
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "VideoSegment.h"
+
+using namespace std;
+using namespace cv;
+
+VideoSegment::VideoSegment(int first_frame, int end_frame, int num_of_markers) : markers(num_of_markers) {
+    this->first_frame = first_frame;
+    this->end_frame = end_frame;
+    this->marker_counter = 0;
+}
+
+VideoSegment::~VideoSegment() = default;
+
+// markers with a computed world transform
+static bool hasWorldPose(const MarkerInfo& marker) {
+    return marker.marker_id != -1 && marker.previous_marker_index != -1;
+}
+
+/// <sumary>
+/// Re-expresses the markers and camera poses of this segment in the world frame of the reference segment.
+/// The transform between the two world frames is averaged over all markers that both segments have mapped.
+/// </sumary>
+/// <param name="reference">Segment, whose world frame is used</param>
+/// <returns>False if the segments share no mapped marker. The segment is left unchanged in that case.</returns>
+bool VideoSegment::alignTo(const VideoSegment& reference) {
+    // for a shared marker: p_reference = A * p_this + b, where A = Rw^T * Rs and b = tw - A * ts
+    Matx33d rotation_sum = Matx33d::zeros();
+    vector<Vec3d> reference_positions, own_positions;
+    for(size_t i = 0; i < markers.size(); i++) {
+        if(!hasWorldPose(markers[i])) continue;
+
+        for(size_t j = 0; j < reference.markers.size(); j++) {
+            if(!hasWorldPose(reference.markers[j]) || reference.markers[j].marker_id != markers[i].marker_id) continue;
+
+            Matx33d reference_rotation = (Matx33d) reference.markers[j].world_orientation_matrix;
+            Matx33d own_rotation = (Matx33d) markers[i].world_orientation_matrix;
+            rotation_sum += reference_rotation.t() * own_rotation;
+            reference_positions.push_back(reference.markers[j].world_position);
+            own_positions.push_back(markers[i].world_position);
+            break;
+        }
+    }
+
+    if(reference_positions.empty()) return false;
+
+    // closest rotation to the averaged one
+    Mat w, u, vt;
+    SVD::compute(Mat(rotation_sum), w, u, vt);
+    Mat rotation = u * vt;
+    if(determinant(rotation) < 0) {
+        Mat last_column = u.col(2);
+        last_column *= -1;
+        rotation = u * vt;
+    }
+    Matx33d A = (Matx33d) rotation;
+
+    Vec3d b(0, 0, 0);
+    for(size_t i = 0; i < reference_positions.size(); i++) {
+        b += reference_positions[i] - A * own_positions[i];
+    }
+    b *= 1.0 / reference_positions.size();
+
+    // markers
+    for(size_t i = 0; i < markers.size(); i++) {
+        if(!hasWorldPose(markers[i])) continue;
+
+        Matx33d own_rotation = (Matx33d) markers[i].world_orientation_matrix;
+        markers[i].world_position = A * markers[i].world_position + b;
+        markers[i].world_orientation_matrix = Mat(own_rotation * A.t());
+        markers[i].world_orientation = Quat<double>::createFromRotMat(markers[i].world_orientation_matrix);
+    }
+
+    // trajectory
+    for(size_t i = 0; i < poses.size(); i++) {
+        if(!poses[i].valid) continue;
+
+        poses[i].position = A * poses[i].position + b;
+        poses[i].orientation_matrix = poses[i].orientation_matrix * A.t();
+    }
+
+    LOG(Info, Main, "Segment starting at frame {} aligned on {} shared markers", first_frame, reference_positions.size());
+    return true;
+}
+
+/// <sumary>
+/// Appends the poses of this segment to the reference segment and adds the markers, that the reference has not mapped yet.
+/// The segment has to be aligned to the reference first.
+/// </sumary>
+/// <param name="reference">Segment into which this one is merged</param>
+void VideoSegment::mergeInto(VideoSegment& reference) const {
+    for(size_t i = 0; i < markers.size(); i++) {
+        if(!hasWorldPose(markers[i])) continue;
+
+        bool known = false;
+        for(size_t j = 0; !known && j < reference.markers.size(); j++) {
+            known = hasWorldPose(reference.markers[j]) && reference.markers[j].marker_id == markers[i].marker_id;
+        }
+        if(known) continue;
+
+        if(reference.marker_counter >= (int) reference.markers.size()) {
+            LOG(Warning, Slam, "No space left for marker with ID: {}", markers[i].marker_id);
+            continue;
+        }
+        reference.markers[reference.marker_counter] = markers[i];
+        reference.marker_counter++;
+    }
+
+    reference.poses.insert(reference.poses.end(), poses.begin(), poses.end());
+}
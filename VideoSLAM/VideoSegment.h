@@ -0,0 +1,24 @@
+#ifndef VIDEO_SEGMENT_H
+#define VIDEO_SEGMENT_H
+
+
+// frames [first_frame, end_frame) of a video, processed with their own marker map and world frame
+class VideoSegment {
+public:
+    // attributes
+    int first_frame;
+    int end_frame;                      // -1 for the end of the video
+    int marker_counter;
+    std::vector<MarkerInfo> markers;
+    std::vector<FramePose> poses;
+
+    // constructors & deconstructors
+    VideoSegment(int first_frame, int end_frame, int num_of_markers);
+    virtual ~VideoSegment();
+
+    // methods
+    bool alignTo(const VideoSegment& reference);
+    void mergeInto(VideoSegment& reference) const;
+};
+
+#endif
@@ -2,25 +2,48 @@
 // or project specific include files that are used frequently, but
 // are changed infrequently
 //
+// Only portable headers belong here, the Windows headers are included by VideoSLAM.cpp.
+// The other sources are also built by CMakeLists.txt into the videoslam_bench program.
 
 #pragma once
 
-#include "targetver.h"
-
 #include <stdio.h>
-#include <tchar.h>
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <map>
+#include <thread>
 #include <fstream>
-#include <direct.h>
+#ifdef _MSC_VER
 #include <filesystem>
+#else
+#include <experimental/filesystem>
+#endif
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/aruco.hpp>
 #include <opencv2/core/quaternion.hpp>
 
+#include "Log.h"
+#include "Metrics.h"
 #include "MarkerInfo.h"
+#include "MarkerMap.h"
+#include "FrameArena.h"
+#include "FrameQuality.h"
 #include "CamCalib.h"
+#include "FastArucoDetector.h"
+#include "PreviewRenderer.h"
+#include "CornerTracker.h"
+#include "Tracker.h"
+#include "DetectorTuner.h"
+#include "BundleAdjuster.h"
+#include "DetectionLog.h"
+#include "VideoSegment.h"
+#include "FrameCache.h"
+#include "TrajectoryEvaluator.h"
+#include "Benchmark.h"
+#include "ImuPreintegrator.h"
+#include "ImuFile.h"
 
 
 